@@ -0,0 +1,52 @@
+#include "animation.h"
+#include "bitbang.h"
+#include "led.h"
+#include "scheduler.h"
+
+__code const uint8_t *__data animation = 0;
+__code const uint8_t *__data nextFrame;  // Its steps byte
+__data uint8_t               stepsLeft;  // Steps the frame on the strip stays
+__bit                        animationDue = 0;
+
+// Runs every interval ms while an animation plays.
+static void stepAnimation()
+{
+    if (stepsLeft && --stepsLeft == 0)
+    {
+        animationDue = 1;
+    }
+}
+
+void startAnimation(__code const uint8_t *show)
+{
+    animation    = show;
+    nextFrame    = show + 1;
+    stepsLeft    = 0;
+    animationDue = 1;
+    scheduleTask(TASK_ANIMATION, stepAnimation, show[0], show[0]);
+}
+
+// Give the strip back to the layers, redrawn in full over the last frame.
+void stopAnimation()
+{
+    if (!animation)
+    {
+        return;
+    }
+
+    cancelTask(TASK_ANIMATION);
+    animation     = 0;
+    animationDue  = 0;
+    ledDirtyCount = LED_COUNT;
+}
+
+void sendAnimationFrame()
+{
+    stepsLeft = nextFrame[0];
+    nextFrame = bigBangWS2812Code(nextFrame + 1);
+    if (*nextFrame == ANIM_END)
+    {
+        nextFrame = animation + 1;
+    }
+    animationDue = 0;
+}
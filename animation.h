@@ -0,0 +1,39 @@
+#pragma once
+
+#include <ch554.h>
+#include <stdint.h>
+
+// Animations are byte strings in code memory, sent frame by frame straight from flash by
+// bigBangWS2812Code(), nothing is copied to XRAM. tools/animation.py converts CSV or PNG frames.
+//
+//   interval                  ms of a step, 2 - 255
+//   steps  runs  ANIM_FRAME_END   A frame, shown for 1 - 255 steps
+//   ...
+//   ANIM_END                  Back to the first frame
+//
+// A run sends 1 - 127 LEDs, GRB at full range, the brightness and gamma are applied while sending:
+//
+//   ANIM_FILL(n) G R B           n LEDs of 1 colour
+//   ANIM_LITERAL(n) G R B ...    n LEDs of their own colour, 3 bytes each
+//
+// A frame covers LED 0 up to the sum of its runs. The LEDs after it keep their colour, so a frame
+// only changing the start of the strip is a delta of the previous one, and a keyframe covers all.
+// The first frame is a keyframe, the animation loops onto it.
+//
+// Example: __code const uint8_t blink[] = {250, 1, ANIM_FILL(27), 0, FULL, 0, ANIM_FRAME_END,
+//                                          1, ANIM_FILL(27), 0, 0, 0, ANIM_FRAME_END, ANIM_END};
+
+#define ANIM_FILL(n)    (n)
+#define ANIM_LITERAL(n) (0x80 | (n))
+#define ANIM_FRAME_END  0x00
+#define ANIM_END        0x00
+
+// Animation playing, or 0. It takes the strip over from the layers of led.h until stopAnimation().
+extern __code const uint8_t *__data animation;
+extern __bit                        animationDue;  // The next frame is due, see sendAnimationFrame()
+
+void startAnimation(__code const uint8_t *show);
+void stopAnimation();
+
+// Send the next frame, with interrupts off like bigBangWS2812().
+void sendAnimationFrame();
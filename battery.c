@@ -0,0 +1,115 @@
+#include "battery.h"
+
+// Schematic
+//
+//   VBAT (18650) ──[100k]──┬──[100k]── GND
+//                          └── P3.2 (AIN3)
+//
+// The ADC measures against VCC, the output of the MT3608 boost, 0.6V x (1 + R2 9k09 / R1 2k) = 3.33V.
+// - Battery under ~3.68V: the boost regulates, VCC = 3.33V and the reading is accurate.
+// - Battery above: the boost passes the battery through L1 and D1 (SS34), VCC follows it ~0.35V
+//   lower. The reading then falls a little as the battery rises, from 0.553 of full scale at
+//   3.68V to 0.544 at 4.3V, the same readings as a regulating battery of 3.625V to 3.68V.
+// Without a reference the two cannot be told apart, so the whole range reads BATTERY_TOP_MV.
+#define VCC_MV          3330
+#define DIODE_MV        350
+#define BOOST_LIMIT_MV  (VCC_MV + DIODE_MV)
+#define BATTERY_MAX_MV  4300  // Full 18650 with some margin
+#define AMBIGUOUS_MV    ((uint32_t)VCC_MV * BATTERY_MAX_MV / (BATTERY_MAX_MV - DIODE_MV))
+
+#if BATTERY_TOP_MV != BOOST_LIMIT_MV
+#error "BATTERY_TOP_MV of battery.h must match the boost limit"
+#endif
+
+// The filter keeps 16 x the reading, 16 x 4080 = 65280 full scale.
+#define FILTER_SHIFT    4
+#define FILTER_FULL     ((uint32_t)BATTERY_OVERSAMPLE * 255 << FILTER_SHIFT)
+#define FILTER_AT(mv)   ((uint16_t)((uint32_t)(mv) * FILTER_FULL / (2 * VCC_MV)))
+
+// A reading is the sum of BATTERY_OVERSAMPLE conversions, done in adc_interrupt().
+__data uint8_t           adcSamplesLeft = 0;
+__data uint16_t          adcSum         = 0;
+__data volatile uint16_t batteryReading = 0;
+volatile __bit           readingReady   = 0;
+
+// Low-pass filter of the readings: filter += reading - filter / 16, about 16 readings to settle.
+__data uint16_t batteryFilter = 0;
+__bit           filterStarted = 0;
+
+void initBattery()
+{
+    // Simplified code from CH554 ADC example.
+    // 1. Enable ADC
+    ADC_CFG |= bADC_CLK;  // ADC_CLK (bit 0): 0 -> slow mode, 384 Fosc cycles for each ADC
+                          //                  1 -> fast mode,  96 Fosc cycles for each ADC
+    ADC_CFG |= bADC_EN;   // ADC_EN  (bit 3): Power enable bit of ADC module
+    // 2. Enable ADC channel 3, P3.2
+    ADC_CHAN0 = 1;
+    ADC_CHAN1 = 1;
+    P3_DIR_PU &= ~bAIN3;
+    // 3. A conversion ends in adc_interrupt()
+    ADC_IF = 0;
+    IE_ADC = 1;
+}
+
+void adc_interrupt(void) __interrupt(INT_NO_ADC)
+{
+    ADC_IF = 0;  // Not cleared by hardware.
+
+    adcSum += ADC_DATA;
+    if (--adcSamplesLeft)
+    {
+        ADC_START = 1;
+    }
+    else
+    {
+        batteryReading = adcSum;
+        readingReady   = 1;
+    }
+}
+
+// Start a reading in the background, ~1.6k Fosc cycles at fast mode.
+void startBatteryReading()
+{
+    if (adcSamplesLeft)
+    {
+        return;
+    }
+
+    adcSum         = 0;
+    adcSamplesLeft = BATTERY_OVERSAMPLE;
+    ADC_START      = 1;
+}
+
+// Feed the last reading to the filter, returns 0 if none has completed since the last call.
+__bit updateBattery()
+{
+    if (!readingReady)
+    {
+        return 0;
+    }
+    readingReady = 0;
+
+    if (!filterStarted)
+    {
+        filterStarted = 1;
+        batteryFilter = batteryReading << FILTER_SHIFT;
+    }
+    else
+    {
+        batteryFilter += batteryReading - (batteryFilter >> FILTER_SHIFT);
+    }
+    return 1;
+}
+
+// Filtered battery voltage, 0 before the first reading. With the boost regulating, the VCC_MV
+// reference and the 1/2 divider give mV = 2 x VCC_MV x filter / FILTER_FULL. From AMBIGUOUS_MV
+// up the battery may be anywhere between there and BATTERY_MAX_MV, see the schematic above.
+uint16_t batteryMillivolts()
+{
+    if (batteryFilter >= FILTER_AT(AMBIGUOUS_MV))
+    {
+        return BATTERY_TOP_MV;
+    }
+    return (uint32_t)batteryFilter * (2 * VCC_MV) / FILTER_FULL;
+}
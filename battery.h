@@ -0,0 +1,15 @@
+#pragma once
+
+#include <ch554.h>
+#include <stdint.h>
+
+#define BATTERY_OVERSAMPLE 16  // ADC samples added in a reading, full scale 16 x 255 = 4080
+#define BATTERY_TOP_MV     3680  // Highest batteryMillivolts(), the battery is at least this much
+
+void     initBattery();
+void     startBatteryReading();
+__bit    updateBattery();
+uint16_t batteryMillivolts();
+
+// SDCC requires the prototype of an interrupt service routine to be visible in main.c.
+void adc_interrupt(void) __interrupt(INT_NO_ADC);
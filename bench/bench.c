@@ -0,0 +1,160 @@
+// Benchmark image of the firmware for the ucsim s51 simulator, see run_bench.py.
+//
+// Each BENCH() runs one case between breakpoints on benchStart() and benchStop(), the simulator's
+// clock count between the 2 stops is the cost of a case. Interrupts stay disabled, the tasks are
+// called directly or through runTasks() with a hand-made time.
+
+#define main firmwareMain
+#include "../main.c"
+#undef main
+
+// battery.c
+extern __data uint8_t           adcSamplesLeft;
+extern __data volatile uint16_t batteryReading;
+extern volatile __bit           readingReady;
+
+void benchStart()
+{
+}
+
+void benchStop()
+{
+}
+
+// `name` is only read by run_bench.py, keep it a plain identifier.
+#define BENCH(name, code) \
+    benchStart();         \
+    code;                 \
+    benchStop()
+
+// Scan a key long enough to be debounced.
+void scanKey(uint8_t key, __bit pressed)
+{
+    if (pressed)
+    {
+        P1 &= ~key;
+    }
+    else
+    {
+        P1 |= key;
+    }
+
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        scanKeys(0);
+    }
+}
+
+// Press and release a key, processEvents() reads both events on its next call.
+void pressKey(uint8_t key)
+{
+    scanKey(key, 1);
+    scanKey(key, 0);
+}
+
+// Start an effect and run it for a while, the twinkles and the fire have lit LEDs by then.
+void startSteppedEffect(uint8_t effect)
+{
+    startEffect(effect);
+    for (uint8_t i = 0; i < 30; i++)
+    {
+        stepEffect();
+    }
+}
+
+// bigBangWS2812() and bigBangWS2812Code() are left out: they switch between the 2 DPTRs of the CH552
+// through XBUS_AUX, and the 8052 of s51 has only 1, so their counts would be wrong. The frame timing
+// is derived in bitbang.c instead.
+void main()
+{
+    initSubway();
+    renderFrame();
+    ledDirtyCount = 0;
+
+    // Call overhead of benchStart() and benchStop(), subtracted from every case.
+    BENCH(calibration, );
+
+    BENCH(setColor, setColor(0, RED));
+    BENCH(setColor_unchanged, setColor(0, RED));
+    setOverlay(1, GREEN);
+    setEffectRGB(2, FULL, 0, 0);
+    ledDirtyCount = LED_COUNT;
+    BENCH(renderFrame, renderFrame());
+    clearOverlay();
+    clearEffects();
+
+    lightMode = 0;
+    BENCH(blinkLights_0, blinkLights());
+    lightMode = 1;
+    BENCH(blinkLights_1, blinkLights());
+    lightMode = 2;
+    BENCH(blinkLights_2, blinkLights());
+    lightMode = 3;
+    BENCH(blinkLights_3, blinkLights());
+    lightMode = 4;
+    BENCH(blinkLights_4, blinkLights());
+
+    startSteppedEffect(EFFECT_RAINBOW);
+    BENCH(stepEffect_rainbow, stepEffect());
+    startSteppedEffect(EFFECT_COMET);
+    BENCH(stepEffect_comet, stepEffect());
+    startSteppedEffect(EFFECT_TWINKLE);
+    BENCH(stepEffect_twinkle, stepEffect());
+    startSteppedEffect(EFFECT_FIRE);
+    BENCH(stepEffect_fire, stepEffect());
+
+    BENCH(blinkSubwayLights, blinkSubwayLights());
+    BENCH(runSubway_arrive, runSubway(1, 1));
+    BENCH(runSubway_depart, runSubway(1, 1));
+    BENCH(runTimetable, runTimetable());
+
+    BENCH(stepFades_none, stepFades());
+    fadeRGB(0, FULL, 0, 0, 4);
+    BENCH(stepFades_1, stepFades());
+    for (LedIndex i = 0; i < LED_COUNT; i++)
+    {
+        fadeRGB(i, 0, HALF, FULL, 4);
+    }
+    BENCH(stepFades_all, stepFades());
+
+    // Key A released, moves line 0.
+    pressKey(KEY_A);
+    BENCH(processEvents, processEvents());
+
+    // The scan running in timer0_interrupt() every other tick.
+    BENCH(scanKeys_idle, scanKeys(0));
+    P1 &= ~KEY_C;
+    BENCH(scanKeys_counting, scanKeys(0));
+    scanKeys(0);
+    scanKeys(0);
+    BENCH(scanKeys_press, scanKeys(0));
+    scanKey(KEY_C, 0);
+    processEvents();
+
+    // The ADC of the CH552 is not simulated, the readings are handed over as adc_interrupt() would.
+    BENCH(batteryCheck_no_reading, batteryCheck());
+    adcSamplesLeft = 0;
+    batteryReading = 2048;
+    readingReady   = 1;
+    BENCH(batteryCheck, batteryCheck());
+    adcSamplesLeft = 0;
+    BENCH(showBatteryGauge, showBatteryGauge());
+
+    // The loop between 2 ticks.
+    runTasks(0);
+    BENCH(runTasks_nothing_due, runTasks(1));
+
+    // Everything due in the same iteration: a key, a blink and the render of a full frame. Sending
+    // it is left out like the other frames, add the frame time of bitbang.c.
+    pressKey(KEY_B);
+    scheduleTask(TASK_BLINK, blinkSubwayLights, 0, 0);
+    systemTime = 100;
+    BENCH(main_loop_worst,
+          runTasks(getTime());
+          processEvents();
+          renderFrame());
+
+    while (1)
+    {
+    }
+}
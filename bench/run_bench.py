@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""Run the benchmark image under ucsim s51 and record the cost of every BENCH() case.
+
+ucsim stops on breakpoints at benchStart() and benchStop(). The difference of its clock counter
+between the 2 stops, minus the `calibration` case, is the cost of a case. ucsim simulates a
+standard MCS-51 (12 clocks per machine cycle), not the CH552's own instruction timing, so the
+counts are not cycle-exact for the CH552. They are reproducible for that core, which is what
+tracking regressions needs.
+
+That core has a single DPTR and no XBUS_AUX, so the frame senders of bitbang.c, which switch
+between the CH552's 2 DPTRs, are not benchmarked.
+
+The results are written as JSON. If the output file already exists, the change of every case is
+printed before it is replaced.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+
+
+def symbol_address(map_file, symbol):
+    pattern = re.compile(r"\b([0-9A-Fa-f]{4,8})\s+" + re.escape(symbol) + r"\b")
+    with open(map_file) as f:
+        for line in f:
+            match = pattern.search(line)
+            if match:
+                return int(match.group(1), 16)
+    sys.exit(f"{symbol} not found in {map_file}")
+
+
+def case_names(source):
+    with open(source) as f:
+        return re.findall(r"^\s*BENCH\((\w+),", f.read(), re.MULTILINE)
+
+
+def run_s51(s51, freq, ihx, start, stop, stops):
+    commands = [f"break 0x{start:04x}", f"break 0x{stop:04x}"]
+    commands += ["run", "state"] * stops
+    commands += ["quit"]
+
+    output = subprocess.run(
+        [s51, "-t", "8052", "-X", str(freq), ihx],
+        input="\n".join(commands) + "\n",
+        capture_output=True,
+        text=True,
+        check=True,
+    ).stdout
+
+    clocks = [int(c) for c in re.findall(r"Total time since last reset=.*\((\d+) clks\)", output)]
+    if len(clocks) != stops:
+        sys.exit(f"expected {stops} stops from {s51}, got {len(clocks)}:\n{output}")
+    return clocks
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("ihx")
+    parser.add_argument("--s51", default="s51")
+    parser.add_argument("--freq", type=int, required=True)
+    parser.add_argument("--source", required=True)
+    parser.add_argument("--map", required=True)
+    parser.add_argument("--output", required=True)
+    args = parser.parse_args()
+
+    names = case_names(args.source)
+    start = symbol_address(args.map, "_benchStart")
+    stop = symbol_address(args.map, "_benchStop")
+    clocks = run_s51(args.s51, args.freq, args.ihx, start, stop, 2 * len(names))
+
+    costs = {name: clocks[2 * i + 1] - clocks[2 * i] for i, name in enumerate(names)}
+    overhead = costs.pop("calibration", 0)
+
+    results = {
+        "freq_sys": args.freq,
+        "core": "mcs51",
+        "timing": "standard 8052, 12 clocks per machine cycle, not cycle-exact for the CH552",
+        "cases": {},
+    }
+    for name, clks in costs.items():
+        clks -= overhead
+        results["cases"][name] = {
+            "clks": clks,
+            "machine_cycles": clks // 12,
+            "us": round(clks * 1e6 / args.freq, 2),
+        }
+
+    if os.path.exists(args.output):
+        with open(args.output) as f:
+            previous = json.load(f).get("cases", {})
+        for name, case in results["cases"].items():
+            before = previous.get(name, {}).get("clks")
+            if before is not None and before != case["clks"]:
+                print(f"{name:24} {before:>10} -> {case['clks']:>10} clks ({case['clks'] - before:+d})")
+
+    with open(args.output, "w") as f:
+        json.dump(results, f, indent=2)
+        f.write("\n")
+
+    for name, case in results["cases"].items():
+        print(f"{name:24} {case['clks']:>10} clks {case['us']:>12} us")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,106 +1,424 @@
 #include <stdint.h>
 #include <ch554.h>
 #include "bitbang.h"
+#include "uart.h"
 
-void bigBangWS2812(uint8_t ledCount, __xdata uint8_t* ledData)
+// WS2812 timing, generated from FREQ_SYS
+//
+// Every bit is sent as:
+//
+//     rlc  a              ; (1) Shift the next bit into C
+//     setb _LED           ; (2) ───┐ the pin goes high at the end of setb
+//     nop x T0H_PAD       ;        │
+//     mov  _LED, c        ; (2)    ├─ T0H    a 0 bit goes low here
+//     nop x T1H_PAD       ;        │
+//     clr  _LED           ; (2) ───┘ T1H     a 1 bit goes low here
+//     nop x TL_PAD        ;        ── TL     low until the next setb
+//
+//   T0H = T0H_PAD + 2                 cycles
+//   T1H = T0H + T1H_PAD + 2           cycles
+//   TL  = TL_PAD + 3 (rlc + setb)     cycles
+//
+// The 8 bits of a byte are unrolled, so no jump falls into the high part of a bit. The byte loop
+// (djnz, movx, inc dptr) and the GAMMA_TABLE lookup (anl, orl, DPTR1 switch, movc) only stretch the
+// TL of the last bit of each byte, by about 1µs at 12 MHz. The LEDs accept several µs before they
+// latch.
+//
+// ledCount is 16 bits, the frame is only limited by XRAM: 3 bytes per LED, or 4 bits with
+// LED_INDEXED.
+//
+// Interrupts are off for the whole frame, 810µs for 27 LEDs, longer than 2 UART bytes. So RI is
+// polled before every LED, and a received byte is kept in uartPending until the caller passes it
+// on with takeUartPending().
+//
+// Datasheet tolerance (WS2812B):
+//   T0H  = 0.40µs ±150ns -> 250 -  550ns
+//   T1H  = 0.80µs ±150ns -> 650 -  950ns
+//   TL  >= 450ns
+//
+// MCU Frequency   T0H          T1H          TL           Bit
+//        32 MHz   12 (375ns)   24 (750ns)   15 (469ns)   1.22µs
+//        24 MHz    9 (375ns)   18 (750ns)   11 (458ns)   1.21µs
+//        16 MHz    6 (375ns)   12 (750ns)    8 (500ns)   1.25µs
+//        12 MHz    5 (417ns)    9 (750ns)    6 (500ns)   1.25µs
+//         6 MHz    2 (333ns)    5 (833ns)    3 (500ns)   1.33µs
+//         3 MHz    rejected, T0H >= 2 cycles = 667ns
+
+#define WS2812_T0H_NS 375
+#define WS2812_T1H_NS 750
+#define WS2812_TL_NS  450
+
+// Cycles in `ns` nanoseconds, rounded to nearest or rounded up.
+#define CYCLES_ROUND(ns) (((ns) * (FREQ_SYS / 1000) + 500000) / 1000000)
+#define CYCLES_CEIL(ns)  (((ns) * (FREQ_SYS / 1000) + 999999) / 1000000)
+
+#if CYCLES_ROUND(WS2812_T0H_NS) > 2
+#define T0H_CYCLES CYCLES_ROUND(WS2812_T0H_NS)
+#else
+#define T0H_CYCLES 2
+#endif
+
+#if CYCLES_ROUND(WS2812_T1H_NS) > T0H_CYCLES + 2
+#define T1H_CYCLES CYCLES_ROUND(WS2812_T1H_NS)
+#else
+#define T1H_CYCLES (T0H_CYCLES + 2)
+#endif
+
+#if CYCLES_CEIL(WS2812_TL_NS) > 3
+#define TL_CYCLES CYCLES_CEIL(WS2812_TL_NS)
+#else
+#define TL_CYCLES 3
+#endif
+
+// Static check of the generated timing, `cycles` is in [min_ns, max_ns].
+#define CYCLES_ABOVE(cycles, ns) ((cycles) * 1000000 >= (ns) * (FREQ_SYS / 1000))
+#define CYCLES_BELOW(cycles, ns) ((cycles) * 1000000 <= (ns) * (FREQ_SYS / 1000))
+
+#if !CYCLES_ABOVE(T0H_CYCLES, 250) || !CYCLES_BELOW(T0H_CYCLES, 550)
+#error "WS2812 T0H can't be met at this FREQ_SYS"
+#endif
+#if !CYCLES_ABOVE(T1H_CYCLES, 650) || !CYCLES_BELOW(T1H_CYCLES, 950)
+#error "WS2812 T1H can't be met at this FREQ_SYS"
+#endif
+#if !CYCLES_ABOVE(TL_CYCLES, 450)
+#error "WS2812 TL can't be met at this FREQ_SYS"
+#endif
+
+#define T0H_PAD (T0H_CYCLES - 2)
+#define T1H_PAD (T1H_CYCLES - T0H_CYCLES - 2)
+#define TL_PAD  (TL_CYCLES - 3)
+
+#if T0H_PAD > 15 || T1H_PAD > 15 || TL_PAD > 15
+#error "WS2812 padding is limited to 15 nops"
+#endif
+
+// Expand the padding counts into nops, 1 bit at a time.
+#define NOP_1 "    nop\n"
+#define NOP_2 NOP_1 NOP_1
+#define NOP_4 NOP_2 NOP_2
+#define NOP_8 NOP_4 NOP_4
+
+#if T0H_PAD & 1
+#define T0H_NOP_1 NOP_1
+#else
+#define T0H_NOP_1
+#endif
+#if T0H_PAD & 2
+#define T0H_NOP_2 NOP_2
+#else
+#define T0H_NOP_2
+#endif
+#if T0H_PAD & 4
+#define T0H_NOP_4 NOP_4
+#else
+#define T0H_NOP_4
+#endif
+#if T0H_PAD & 8
+#define T0H_NOP_8 NOP_8
+#else
+#define T0H_NOP_8
+#endif
+
+#if T1H_PAD & 1
+#define T1H_NOP_1 NOP_1
+#else
+#define T1H_NOP_1
+#endif
+#if T1H_PAD & 2
+#define T1H_NOP_2 NOP_2
+#else
+#define T1H_NOP_2
+#endif
+#if T1H_PAD & 4
+#define T1H_NOP_4 NOP_4
+#else
+#define T1H_NOP_4
+#endif
+#if T1H_PAD & 8
+#define T1H_NOP_8 NOP_8
+#else
+#define T1H_NOP_8
+#endif
+
+#if TL_PAD & 1
+#define TL_NOP_1 NOP_1
+#else
+#define TL_NOP_1
+#endif
+#if TL_PAD & 2
+#define TL_NOP_2 NOP_2
+#else
+#define TL_NOP_2
+#endif
+#if TL_PAD & 4
+#define TL_NOP_4 NOP_4
+#else
+#define TL_NOP_4
+#endif
+#if TL_PAD & 8
+#define TL_NOP_8 NOP_8
+#else
+#define TL_NOP_8
+#endif
+
+#define T0H_NOPS T0H_NOP_1 T0H_NOP_2 T0H_NOP_4 T0H_NOP_8
+#define T1H_NOPS T1H_NOP_1 T1H_NOP_2 T1H_NOP_4 T1H_NOP_8
+#define TL_NOPS  TL_NOP_1 TL_NOP_2 TL_NOP_4 TL_NOP_8
+
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+
+#define WS2812_BIT                                                                     \
+    "    rlc a               ; Shift the LED data value left to get the high bit (1) \n" \
+    "    setb _LED           ; Begin bit cycle- set bit high (2)                     \n" \
+    T0H_NOPS                                                                           \
+    "    mov _LED, c         ; Set the output bit low if the current bit is low (2)  \n" \
+    T1H_NOPS                                                                           \
+    "    clr _LED            ; final part of bit cycle, set bit low (2)              \n" \
+    TL_NOPS
+
+__data uint8_t ledBrightness = 0;
+
+// Common parts of the routines. jz, jbc and sjmp only reach 127 bytes and 8 unrolled bits take
+// about 120, so the jumps across the bits go through ljmp.
+#define WS2812_START                                                                             \
+    "mov r1, #_uartPending   ; No UART byte received yet                                 \n" \
+    "mov r2, dpl             ; Load the LED count into r2 (low) and r7 (high)            \n" \
+    "mov r7, dph                                                                         \n" \
+    "mov a, r2                                                                           \n" \
+    "orl a, r7                                                                           \n" \
+    "jnz 00009$                                                                          \n" \
+    "ljmp 00003$             ; Nothing to send if ledCount is 0                          \n" \
+    "00009$:                                                                             \n" \
+    "mov a, r2               ; djnz r2 then djnz r7 counts ledCount down                 \n" \
+    "jz 00010$                                                                           \n" \
+    "inc r7                                                                              \n" \
+    "00010$:                                                                             \n"
+
+// Keep a UART byte received while interrupts are off, unless uartPending is full. Runs before
+// every LED, 115200 baud brings a byte every 87µs.
+#define WS2812_UART                                                                              \
+    "    jnb _RI, 00005$                                                                 \n" \
+    "    clr _RI                                                                         \n" \
+    "    cjne r1, #(_uartPending + " TO_STRING(UART_PENDING_SIZE) "), 00006$              \n" \
+    "    sjmp 00005$                                                                     \n" \
+    "00006$:                                                                             \n" \
+    "    mov @r1, _SBUF                                                                  \n" \
+    "    inc r1                                                                          \n" \
+    "00005$:                                                                             \n"
+
+#define WS2812_LOOP_END                                                                          \
+    "    djnz r3, 00007$     ; If there are more bytes in this LED                       \n" \
+    "    djnz r2, 00008$     ; If there are more LEDs                                    \n" \
+    "    djnz r7, 00008$                                                                 \n" \
+    "    sjmp 00003$                                                                     \n" \
+    "00007$:                                                                             \n" \
+    "    ljmp 00002$                                                                     \n" \
+    "00008$:                                                                             \n" \
+    "    ljmp 00001$                                                                     \n"
+
+#define WS2812_END                                                                               \
+    "00003$:                 ; uartPendingCount = r1 - uartPending                       \n" \
+    "    mov a, r1                                                                       \n" \
+    "    clr c                                                                           \n" \
+    "    subb a, #_uartPending                                                           \n" \
+    "    mov _uartPendingCount, a                                                        \n"
+
+#ifndef LED_INDEXED
+
+void bigBangWS2812(uint16_t ledCount, __xdata uint8_t* ledData)
 {
     ledCount;
     ledData;
 
     // Bitbang routine
     // Input parameters: (determined by compilation)
-    // * byteCount should be allocated in dpl
-    // * ledData should be allocated with name '_bigBangWS2812_PARAM_2'
+    // * ledCount should be allocated in dpl, dph
+    // * ledData should be allocated with name '_bigBangWS2812_PARM_2'
 
     // Strategy:
-    // * Keep the data memory pointer in DPTR
-    // * Keep ledCount in r2
-    // * Store bitCount in r3
+    // * Keep the data memory pointer in DPTR0
+    // * Keep GAMMA_TABLE in DPTR1, selected by DPS (bit 0 of XBUS_AUX)
+    // * Keep ledCount in r2, r7
+    // * Store byteCount (3 bytes per LED) in r3
+    // * Keep ledBrightness in r4
+    // * Keep the next free byte of uartPending in r1
     // * Store the current data variable in ACC
 
-    //  TODO: What context needs to be pushed/popped?
-
     __asm__(
-        "mov r2, dpl             ; Load the LED count into r2                                \n"
+        WS2812_START
+        "mov r4, _ledBrightness  ; Load the brightness level into r4                         \n"
+
+        "orl _XBUS_AUX, #0x01    ; Select DPTR1                                              \n"
+        "mov dptr, #_GAMMA_TABLE ; Load the lookup table address into DPTR1                  \n"
+        "anl _XBUS_AUX, #0xFE    ; Select DPTR0                                              \n"
 
         "mov dpl, _bigBangWS2812_PARM_2  ; Load the LED data start address into DPTR         \n"
         "mov dph, (_bigBangWS2812_PARM_2 + 1)                                                \n"
 
-        "00001$:                 ; byte loop                                                 \n"
+        "00001$:                 ; LED loop                                                  \n"
+        WS2812_UART
+        "    mov r3, #3          ; G, R, B                                                   \n"
 
-        // Red byte
+        "00002$:                 ; byte loop                                                 \n"
         "    movx a,@dptr        ; Load the current LED data value into the accumulator (1)  \n"
         "    inc dptr            ; and advance the counter for the next LED data value (1)   \n"
+        "    anl a, #0xFC        ; Look the value up at (value & 0xFC) | brightness          \n"
+        "    orl a, r4                                                                       \n"
+        "    orl _XBUS_AUX, #0x01                                                            \n"
+        "    movc a, @a+dptr                                                                 \n"
+        "    anl _XBUS_AUX, #0xFE                                                            \n"
 
-        "    mov r3, #8          ; Set up the bit loop (2)                                   \n"
-        "00002$:                 ; red bit loop                                              \n"
-        "    setb _LED           ; Begin bit cycle- set bit high (2)                         \n"
+        WS2812_BIT WS2812_BIT WS2812_BIT WS2812_BIT
+        WS2812_BIT WS2812_BIT WS2812_BIT WS2812_BIT
 
-        "    nop                 ; Tune this count by hand, want ~.4uS (1*2)                 \n"
-        "    nop                                                                             \n"
+        WS2812_LOOP_END
+        WS2812_END);
+}
 
-        "    rlc A               ; Shift the LED data value left to get the high bit (1)     \n"
-        "    mov _LED, C         ; Set the output bit high if the current bit is high, (2)   \n"
-        "                        ; otherwise set it low                                      \n"
+#else
 
-        "    nop                 ; Tune this count by hand, want ~.4uS (1*2)                 \n"
-        "    nop                                                                             \n"
+// Indexed frames, see palette.c: a nibble per LED, low nibble first, expanded through ledWire,
+// the palette with brightness and gamma applied. Looking the entry up happens in the TL of the
+// last bit of an LED, about 3µs at 12 MHz, the byte loop stays as short as in GRB frames.
+void bigBangWS2812(uint16_t ledCount, __xdata uint8_t* ledData)
+{
+    ledCount;
+    ledData;
 
-        "    clr _LED            ; final part of bit cycle, set bit low (2)                  \n"
+    // Strategy:
+    // * Keep the frame pointer in DPTR0
+    // * Point DPTR1 at the ledWire entry of the current LED, selected by DPS (bit 0 of XBUS_AUX)
+    // * Keep ledCount in r2, r7
+    // * Store byteCount (3 bytes per LED) in r3
+    // * Keep the frame byte of the current pair of LEDs in r4, F0 set on the even LED
+    // * Keep the next free byte of uartPending in r1
+    // * Store the current data variable in ACC
 
-        // "    nop                 ; Tune this count by hand, want ~.45uS                      \n"
-        // "    nop                                                                             \n"
+    __asm__(
+        WS2812_START
+        "clr _F0                 ; The first LED takes the low nibble of a new byte          \n"
 
-        "    djnz r3, 00002$     ; If there are more bits in this byte (2, ?)                \n"
+        "mov dpl, _bigBangWS2812_PARM_2  ; Load the LED data start address into DPTR         \n"
+        "mov dph, (_bigBangWS2812_PARM_2 + 1)                                                \n"
 
-        // Green byte
-        "    movx a,@dptr        ; Load the current LED data value into the accumulator (1)  \n"
-        "    inc dptr            ; and advance the counter for the next LED data value (1)   \n"
+        "00001$:                 ; LED loop                                                  \n"
+        WS2812_UART
+        "    cpl _F0             ; Even LED: load a byte, odd LED: its high nibble           \n"
+        "    jnb _F0, 00011$                                                                 \n"
+        "    movx a, @dptr                                                                   \n"
+        "    inc dptr                                                                        \n"
+        "    mov r4, a                                                                       \n"
+        "    sjmp 00012$                                                                     \n"
+        "00011$:                                                                             \n"
+        "    mov a, r4                                                                       \n"
+        "    swap a                                                                          \n"
+        "00012$:                 ; DPTR1 = ledWire + 3 x entry                               \n"
+        "    anl a, #0x0F                                                                    \n"
+        "    mov b, #3                                                                       \n"
+        "    mul ab                                                                          \n"
+        "    add a, #<_ledWire                                                               \n"
+        "    orl _XBUS_AUX, #0x01                                                            \n"
+        "    mov dpl, a                                                                      \n"
+        "    clr a                                                                           \n"
+        "    addc a, #>_ledWire                                                              \n"
+        "    mov dph, a                                                                      \n"
+        "    anl _XBUS_AUX, #0xFE                                                            \n"
+        "    mov r3, #3          ; G, R, B                                                   \n"
 
-        "    mov r3, #8          ; Set up the bit loop (2)                                   \n"
-        "00003$:                 ; red bit loop                                              \n"
-        "    setb _LED           ; Begin bit cycle- set bit high (2)                         \n"
+        "00002$:                 ; byte loop                                                 \n"
+        "    orl _XBUS_AUX, #0x01                                                            \n"
+        "    movx a, @dptr       ; Load the next byte of the entry (1)                       \n"
+        "    inc dptr                                                                        \n"
+        "    anl _XBUS_AUX, #0xFE                                                            \n"
 
-        "    nop                 ; Tune this count by hand, want ~.4uS (1*2)                 \n"
-        "    nop                                                                             \n"
+        WS2812_BIT WS2812_BIT WS2812_BIT WS2812_BIT
+        WS2812_BIT WS2812_BIT WS2812_BIT WS2812_BIT
+
+        WS2812_LOOP_END
+        WS2812_END);
+}
 
-        "    rlc A               ; Shift the LED data value left to get the high bit (1)     \n"
-        "    mov _LED, C         ; Set the output bit high if the current bit is high, (2)   \n"
-        "                        ; otherwise set it low                                      \n"
+#endif
 
-        "    nop                 ; Tune this count by hand, want ~.4uS (1*2)                 \n"
-        "    nop                                                                             \n"
+// Frames of an animation in code memory, see animation.h: runs of 1 colour or of 1 colour per LED,
+// read with movc and sent without a copy. A fill run sends its colour again for every LED. The run
+// bytes are read in the TL of the last bit of a run, like a byte of the frame.
+static __code const uint8_t *__data codeFrameNext;  // Frame after the one sent, set by the asm below
 
-        "    clr _LED            ; final part of bit cycle, set bit low (2)                  \n"
+__code const uint8_t *bigBangWS2812Code(__code const uint8_t *frame)
+{
+    frame;
 
-        // "    nop                 ; Tune this count by hand, want ~.45uS                      \n"
-        // "    nop                                                                             \n"
+    // Strategy:
+    // * Keep the frame pointer in DPTR0, from dpl, dph
+    // * Keep GAMMA_TABLE in DPTR1, selected by DPS (bit 0 of XBUS_AUX)
+    // * Keep the run byte in r2, its LEDs left in r7
+    // * Keep the colour of the run in r5, r6
+    // * Store byteCount (3 bytes per LED) in r3
+    // * Keep ledBrightness in r4
+    // * Keep the next free byte of uartPending in r1
+    // * Store the frame pointer after ANIM_FRAME_END in codeFrameNext, returned from C
 
-        "    djnz r3, 00003$     ; If there are more bits in this byte (2, ?)                \n"
+    __asm__(
+        "mov r1, #_uartPending   ; No UART byte received yet                                 \n"
+        "mov r4, _ledBrightness  ; Load the brightness level into r4                         \n"
 
-        // Blue byte
-        "    movx a,@dptr        ; Load the current LED data value into the accumulator (1)  \n"
-        "    inc dptr            ; and advance the counter for the next LED data value (1)   \n"
+        "orl _XBUS_AUX, #0x01    ; Select DPTR1                                              \n"
+        "mov dptr, #_GAMMA_TABLE ; Load the lookup table address into DPTR1                  \n"
+        "anl _XBUS_AUX, #0xFE    ; Select DPTR0, the frame                                   \n"
 
-        "    mov r3, #8          ; Set up the bit loop (2)                                   \n"
-        "00004$:                 ; red bit loop                                              \n"
-        "    setb _LED           ; Begin bit cycle- set bit high (2)                         \n"
+        "00009$:                 ; run loop                                                  \n"
+        "    clr a                                                                           \n"
+        "    movc a, @a+dptr     ; Load the run byte                                         \n"
+        "    inc dptr                                                                        \n"
+        "    jnz 00012$                                                                      \n"
+        "    ljmp 00003$         ; ANIM_FRAME_END                                            \n"
+        "00012$:                                                                             \n"
+        "    mov r2, a                                                                       \n"
+        "    anl a, #0x7F        ; LEDs in the run                                           \n"
+        "    mov r7, a                                                                       \n"
+        "    mov r5, dpl         ; Start of its colour                                       \n"
+        "    mov r6, dph                                                                     \n"
 
-        "    nop                 ; Tune this count by hand, want ~.4uS (1*2)                 \n"
-        "    nop                                                                             \n"
+        "00001$:                 ; LED loop                                                  \n"
+        WS2812_UART
+        "    mov r3, #3          ; G, R, B                                                   \n"
 
-        "    rlc A               ; Shift the LED data value left to get the high bit (1)     \n"
-        "    mov _LED, C         ; Set the output bit high if the current bit is high, (2)   \n"
-        "                        ; otherwise set it low                                      \n"
+        "00002$:                 ; byte loop                                                 \n"
+        "    clr a                                                                           \n"
+        "    movc a, @a+dptr     ; Load the current LED data value into the accumulator      \n"
+        "    inc dptr                                                                        \n"
+        "    anl a, #0xFC        ; Look the value up at (value & 0xFC) | brightness          \n"
+        "    orl a, r4                                                                       \n"
+        "    orl _XBUS_AUX, #0x01                                                            \n"
+        "    movc a, @a+dptr                                                                 \n"
+        "    anl _XBUS_AUX, #0xFE                                                            \n"
 
-        "    nop                 ; Tune this count by hand, want ~.4uS (1*2)                 \n"
-        "    nop                                                                             \n"
+        WS2812_BIT WS2812_BIT WS2812_BIT WS2812_BIT
+        WS2812_BIT WS2812_BIT WS2812_BIT WS2812_BIT
 
-        "    clr _LED            ; final part of bit cycle, set bit low (2)                  \n"
+        "    djnz r3, 00007$     ; If there are more bytes in this LED                       \n"
+        "    mov a, r2           ; A fill run sends the same colour again                    \n"
+        "    jb acc.7, 00010$                                                                \n"
+        "    mov dpl, r5                                                                     \n"
+        "    mov dph, r6                                                                     \n"
+        "00010$:                                                                             \n"
+        "    djnz r7, 00008$     ; If there are more LEDs in this run                        \n"
+        "    jb acc.7, 00011$    ; Step over the colour of a fill run                        \n"
+        "    inc dptr                                                                        \n"
+        "    inc dptr                                                                        \n"
+        "    inc dptr                                                                        \n"
+        "00011$:                                                                             \n"
+        "    ljmp 00009$                                                                     \n"
+        "00007$:                                                                             \n"
+        "    ljmp 00002$                                                                     \n"
+        "00008$:                                                                             \n"
+        "    ljmp 00001$                                                                     \n"
 
-        // "    nop                 ; Tune this count by hand, want ~.45uS                      \n"
-        // "    nop                                                                             \n"
-        "    djnz r3, 00004$     ; If there are more bits in this byte (2, ?)                \n"
+        WS2812_END
+        "    mov _codeFrameNext, dpl                                                         \n"
+        "    mov (_codeFrameNext + 1), dph                                                   \n");
 
-        "    djnz r2, 00001$     ; If there are more LEDs (2, ?)                             \n");
+    return codeFrameNext;
 }
@@ -1,3 +1,12 @@
 #pragma once
 
-void bigBangWS2812(uint8_t ledCount, __xdata uint8_t* ledData);
+#include "gamma.h"
+
+// Brightness level applied while sending, 0 to BRIGHTNESS_LEVELS - 1.
+extern __data uint8_t ledBrightness;
+
+// Send LED 0 to ledCount - 1 of ledData, GRB, or palette nibbles with LED_INDEXED, see led.h.
+void bigBangWS2812(uint16_t ledCount, __xdata uint8_t* ledData);
+
+// Send a frame of an animation from code memory, see animation.h, returns the byte after it.
+__code const uint8_t *bigBangWS2812Code(__code const uint8_t *frame);
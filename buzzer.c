@@ -1,6 +1,5 @@
 #include "buzzer.h"
-
-#include <debug.h>
+#include "clock.h"
 
 // Schematic
 //                             VCC
@@ -20,54 +19,239 @@
 #define BUZZER_PIN 4             // P3.4 - Buzzer
 SBIT(BUZZER, 0xB0, BUZZER_PIN);  // P3.4
 
-// The length of half period of notes in µs.
-// -> 1,000,000µs / Note_Frequency / 2
-__xdata const uint16_t NOTES_HALF_PERIOD_us[] = {
-    1911, 1703, 1517, 1432, 1276, 1136, 1012,  // C4 - B4
-    956,  851,  758,  716,  638,  568,  506    // C5 - B5
+// Timer2 runs in 16-bit auto-reload mode, clocked at MCU_Frequency/12 (bT2_CLK = 0).
+// The interrupt is triggered every (0xFFFF + 1 - RCAP2) timer clocks.
+#define T2_TICKS_PER_MS (FREQ_SYS / 12000)
+
+// Timer2 clocks in the half period of a note, from the frequency of its octave 3 in 1/100 Hz.
+// -> MCU_Frequency / 12 / Note_Frequency / 2, rounded
+#define NOTE_TICKS(centihertz, octave)                                          \
+    ((uint16_t)(((FREQ_SYS / 12) * 50 + ((uint32_t)(centihertz) << ((octave) - 3)) / 2) \
+                / ((uint32_t)(centihertz) << ((octave) - 3))))
+
+#define NOTE_OCTAVE(o)                                                                      \
+    NOTE_TICKS(13081, o), NOTE_TICKS(13859, o), NOTE_TICKS(14683, o), NOTE_TICKS(15556, o), \
+    NOTE_TICKS(16481, o), NOTE_TICKS(17461, o), NOTE_TICKS(18500, o), NOTE_TICKS(19600, o), \
+    NOTE_TICKS(20765, o), NOTE_TICKS(22000, o), NOTE_TICKS(23308, o), NOTE_TICKS(24694, o)
+
+#if NOTE_OCTAVE_MIN != 3 || NOTE_OCTAVE_MAX != 7
+#error "NOTES_HALF_PERIOD covers C3 - B7"
+#endif
+
+// C3 - B7, generated from FREQ_SYS
+__code const uint16_t NOTES_HALF_PERIOD[] = {
+    NOTE_OCTAVE(3), NOTE_OCTAVE(4), NOTE_OCTAVE(5), NOTE_OCTAVE(6), NOTE_OCTAVE(7)  //
 };
 
-// Number of waves every 100 ms.
-// -> Note_Frequency / 10
-__xdata const uint8_t NOTES_WAVES_IN_100ms[] = {
-    26, 29, 33, 35, 39, 44, 49,  // C4 - B4
-    52, 59, 66, 70, 78, 88, 99   // C5 - B5
+// Length of LEN_1 .. LEN_DOT | LEN_64 in 1/64 notes
+__code const uint8_t NOTE_LENGTHS[16] = {
+    64, 32, 16, 8, 4, 2, 1, 1,  //
+    96, 48, 24, 12, 6, 3, 2, 2  // Dotted
 };
 
+#define DEFAULT_TEMPO  31  // ms of a 1/64 note, TEMPO(120)
+#define DEFAULT_OCTAVE 4
+#define DEFAULT_GAP    3
+
+// Melody queue, written by startMelody() and consumed by timer2_interrupt().
+__code const uint8_t *__xdata melodyQueue[MELODY_QUEUE_SIZE];
+__data volatile uint8_t       melodyHead = 0;
+__data volatile uint8_t       melodyTail = 0;
+
+// Playback state, only touched by timer2_interrupt() while timer2 is running.
+__code const uint8_t *__data melodyNote = 0;  // The next byte of the current melody
+__data uint8_t               unitTime;        // ms of a 1/64 note
+__data uint8_t               octaveBase;      // Index of C in NOTES_HALF_PERIOD
+__data uint8_t               noteGap;         // 1/16 of the note length
+__data uint16_t              gapLeft   = 0;   // ms of silence after the current note
+__data uint16_t              stepTicks = 0;   // Timer2 clocks between 2 interrupts
+__data uint16_t              stepTime  = 0;   // Timer2 clocks counted toward the next ms
+__data uint16_t              stepLeft  = 0;   // ms left in the current note or pause
+__bit                        toneOn    = 0;   // Toggle the buzzer in the current step
+
 void initBuzzer()
 {
     P3_MOD_OC &= ~(1 << BUZZER_PIN);
     P3_DIR_PU |= 1 << BUZZER_PIN;
     BUZZER = 0;
+
+    // Timer2 in 16-bit auto-reload mode, stopped until a melody is started.
+    // - The reset value of T2CON & T2MOD = 0x00
+    // - C_T2 = 0, CP_RL2 = 0
+    T2CON = 0;
+    ET2   = 1;
+}
+
+// Also runs in timer2_interrupt(), its parameters must not share memory with the main loop.
+#pragma save
+#pragma nooverlay
+static void setStep(uint16_t ticks, uint16_t time)
+{
+    const uint16_t reload = -ticks;
+
+    RCAP2L    = reload;
+    RCAP2H    = reload >> 8;
+    TL2       = reload;
+    TH2       = reload >> 8;
+    stepTicks = ticks;
+    stepTime  = 0;
+    stepLeft  = time;
 }
+#pragma restore
 
-// Play a melody
-// - melody = [melody length, note_0, note_0_beats, note_1, note_1_beats...]
-//   - a beat last 100ms.
-//   - a 50ms pause is placed between 2 notes.
-void playBuzzer(__xdata const uint8_t *melody)
+// Load the next note or pause, runs in timer2_interrupt().
+static void nextStep()
 {
-    const uint8_t length = *melody++;
-    for (uint8_t note = 0; note < length; note++)
+    BUZZER = 0;
+
+    if (toneOn && gapLeft)
     {
-        uint8_t  waves = NOTES_WAVES_IN_100ms[*melody];    // The number of waves in 100ms.
-        uint16_t delay = NOTES_HALF_PERIOD_us[*melody++];  // The half period of the wave.
-        // The 2 while loops play the note waves x beats times, which last 100ms x beats.
-        while (waves--)
+        // Silence at the end of the note
+        toneOn = 0;
+        setStep(T2_TICKS_PER_MS, gapLeft);
+        return;
+    }
+    toneOn = 0;
+
+    for (;;)
+    {
+        if (melodyNote == 0)
         {
-            uint8_t beats = *melody;
-            while (beats--)
+            if (melodyTail == melodyHead)
             {
-                BUZZER = 1;
-                mDelayuS(delay);
-                BUZZER = 0;
-                mDelayuS(delay);
+                // Nothing left to play
+                TR2 = 0;
+                return;
+            }
+
+            melodyNote = melodyQueue[melodyTail];
+            melodyTail = (melodyTail + 1) & (MELODY_QUEUE_SIZE - 1);
+            unitTime   = DEFAULT_TEMPO;
+            octaveBase = (DEFAULT_OCTAVE - NOTE_OCTAVE_MIN) * 12;
+            noteGap    = DEFAULT_GAP;
+        }
+
+        const uint8_t code = *melodyNote++;
+        switch (code & 0xF0)
+        {
+            case OCTAVE(0):
+                if ((code & 0x0F) >= NOTE_OCTAVE_MIN && (code & 0x0F) <= NOTE_OCTAVE_MAX)
+                {
+                    octaveBase = ((code & 0x0F) - NOTE_OCTAVE_MIN) * 12;
+                }
+                break;
+            case GAP(0):
+                noteGap = code & 0x0F;
+                break;
+            case 0xF0:
+                if (code == MELODY_END)
+                {
+                    melodyNote = 0;
+                }
+                else
+                {
+                    const uint8_t tempo = *melodyNote++;
+                    unitTime            = tempo ? tempo : unitTime;
+                }
+                break;
+            default:
+            {
+                // No 16-bit multiply here: SDCC calls the non-reentrant __mulint for it, which the
+                // main loop uses too. 8 x 8 bits is done inline with MUL AB, and the gap by shifts.
+                const uint8_t  length = NOTE_LENGTHS[code & 0x0F];
+                const uint16_t time   = length * unitTime;
+
+                if (code >= NOTE_REST)
+                {
+                    setStep(T2_TICKS_PER_MS, time);
+                    return;
+                }
+
+                uint16_t part = time >> 4;  // (time >> 4) x noteGap, 1 bit of the gap at a time
+                uint8_t  gap  = noteGap;
+                gapLeft       = 0;
+                while (gap)
+                {
+                    if (gap & 1)
+                    {
+                        gapLeft += part;
+                    }
+                    part <<= 1;
+                    gap >>= 1;
+                }
+                toneOn  = 1;
+                setStep(NOTES_HALF_PERIOD[octaveBase + (code >> 4)], time - gapLeft);
+                return;
             }
         }
+    }
+}
+
+// Toggles the buzzer every half period, and counts the time of the step in ms whatever the period.
+void timer2_interrupt(void) __interrupt(INT_NO_TMR2)
+{
+    TF2 = 0;  // Timer2 overflow flag is not cleared by hardware.
+
+    if (toneOn)
+    {
+        BUZZER = !BUZZER;
+    }
+
+    stepTime += stepTicks;
+    while (stepTime >= T2_TICKS_PER_MS)
+    {
+        stepTime -= T2_TICKS_PER_MS;
+        if (--stepLeft == 0)
+        {
+            nextStep();
+            return;
+        }
+    }
+}
 
-        melody++;
+// Queue a melody, it starts right away if the buzzer is idle. See buzzer.h for the format.
+// - The melody is dropped if the queue is full.
+void startMelody(__code const uint8_t *melody)
+{
+    const uint8_t next = (melodyHead + 1) & (MELODY_QUEUE_SIZE - 1);
+    if (next == melodyTail)
+    {
+        return;
+    }
+
+    melodyQueue[melodyHead] = melody;
+    melodyHead              = next;
 
-        // Pause between 2 notes
-        mDelaymS(50);
+    ET2 = 0;
+    if (!TR2)
+    {
+        waitForFastClock();  // The tone periods are built for FREQ_SYS
+
+        // Fire the first interrupt right away, a full ms of a 1-clock step, to load the first note.
+        toneOn     = 0;
+        melodyNote = 0;
+        setStep(1, 1);
+        stepTime = T2_TICKS_PER_MS - 1;
+        TR2      = 1;
     }
+    ET2 = 1;
+}
+
+// Stop playing and drop all queued melodies.
+void stopMelody()
+{
+    ET2 = 0;
+    TR2 = 0;
+    TF2 = 0;
+    ET2 = 1;
+
+    melodyTail = melodyHead;
+    melodyNote = 0;
+    toneOn     = 0;
+    BUZZER     = 0;
+}
+
+__bit isBuzzerBusy()
+{
+    return TR2;
 }
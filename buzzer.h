@@ -3,22 +3,59 @@
 #include <ch554.h>
 #include <stdint.h>
 
-// Music Notes
+// Melodies are byte strings in code memory, ended by MELODY_END. tools/rtttl.py converts RTTTL.
+//
+//   semitone | length    Play a note of the current octave, or a rest
+//   OCTAVE(o)            Octave of the following notes, NOTE_OCTAVE_MIN - NOTE_OCTAVE_MAX
+//   GAP(n)               Silence at the end of every note, n/16 of its length (0 = legato)
+//   TEMPO(bpm)           Quarter notes per minute, 15 - 255 (2 bytes)
+//
+// Every melody starts with TEMPO(120), OCTAVE(4), GAP(3).
+//
+// Example: __code const uint8_t beep[] = {OCTAVE(5), NOTE_A | LEN_8, NOTE_E | LEN_4 | LEN_DOT, MELODY_END};
+
+// Semitones, high nibble
 // https://en.wikipedia.org/wiki/Piano_key_frequencies
-#define C4 0   // Frequency = 261.6256 Hz, Period = 3822.2559 µs
-#define D4 1   // Frequency = 293.6648 Hz, Period = 3405.2430 µs
-#define E4 2   // Frequency = 329.6276 Hz, Period = 3033.7265 µs
-#define F4 3   // Frequency = 349.2282 Hz, Period = 2863.4572 µs
-#define G4 4   // Frequency = 391.9954 Hz, Period = 2551.0503 µs
-#define A4 5   // Frequency = 440.0000 Hz, Period = 2272.7273 µs
-#define B4 6   // Frequency = 493.8833 Hz, Period = 2024.7698 µs
-#define C5 7   // Frequency = 523.2511 Hz, Period = 1911.1283 µs
-#define D5 8   // Frequency = 587.3295 Hz, Period = 1702.6218 µs
-#define E5 9   // Frequency = 659.2551 Hz, Period = 1516.8635 µs
-#define F5 10  // Frequency = 698.4565 Hz, Period = 1431.7284 µs
-#define G5 11  // Frequency = 783.9909 Hz, Period = 1275.5250 µs
-#define A5 12  // Frequency = 880.0000 Hz, Period = 1136.3636 µs
-#define B5 13  // Frequency = 987.7666 Hz, Period = 1012.3849 µs
+#define NOTE_C    0x00
+#define NOTE_CS   0x10
+#define NOTE_D    0x20
+#define NOTE_DS   0x30
+#define NOTE_E    0x40
+#define NOTE_F    0x50
+#define NOTE_FS   0x60
+#define NOTE_G    0x70
+#define NOTE_GS   0x80
+#define NOTE_A    0x90
+#define NOTE_AS   0xA0
+#define NOTE_B    0xB0
+#define NOTE_REST 0xC0
+
+// Lengths, low nibble
+#define LEN_1     0x00  // Whole note
+#define LEN_2     0x01
+#define LEN_4     0x02
+#define LEN_8     0x03
+#define LEN_16    0x04
+#define LEN_32    0x05
+#define LEN_64    0x06
+#define LEN_DOT   0x08  // x 1.5
+
+// Controls
+#define OCTAVE(o)   (0xD0 | (o))
+#define GAP(n)      (0xE0 | (n))
+#define TEMPO(bpm)  0xF0, (uint8_t)((3750 + (bpm) / 2) / (bpm))  // ms of a 1/64 note
+#define MELODY_END  0xFF
+
+#define NOTE_OCTAVE_MIN 3  // C3 = 130.81 Hz
+#define NOTE_OCTAVE_MAX 7  // B7 = 3951.07 Hz
+
+// Number of melodies that can wait behind the one playing, must be a power of 2.
+#define MELODY_QUEUE_SIZE 4
 
 void initBuzzer();
-void playBuzzer(__xdata const uint8_t *melody);
+void startMelody(__code const uint8_t *melody);
+void stopMelody();
+__bit isBuzzerBusy();
+
+// SDCC requires the prototype of an interrupt service routine to be visible in main.c.
+void timer2_interrupt(void) __interrupt(INT_NO_TMR2);
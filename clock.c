@@ -0,0 +1,57 @@
+#include "clock.h"
+
+#define CLOCK_SEL_SLOW 0x02  // CLOCK_CFG system clock select of 3 MHz
+
+volatile __bit clockSlow   = 0;
+volatile __bit clockToSlow = 0;  // Asked for by the main loop, applied at the next tick
+__data uint8_t clockSelFast;     // CLOCK_CFG system clock select of FREQ_SYS, set by CfgFsys()
+
+void initClock()
+{
+    clockSelFast = CLOCK_CFG & MASK_SYS_CK_SEL;
+}
+
+void setSlowClock(__bit slow)
+{
+#ifdef CLOCK_SCALING
+    clockToSlow = slow;
+#else
+    (void)slow;
+#endif
+}
+
+static __bit isClockSlow()
+{
+    return clockSlow;
+}
+
+void waitForFastClock()
+{
+    clockToSlow = 0;
+
+    // The check is a call, so the clock of the host build advances while it waits.
+    while (isClockSlow())
+    {
+    }
+}
+
+#pragma save
+#pragma nooverlay
+void updateClock()
+{
+    if (clockToSlow == clockSlow)
+    {
+        return;
+    }
+
+    clockSlow = clockToSlow;
+
+    // The safe mode lasts a few cycles, the UART interrupt must not take them.
+    EA       = 0;
+    SAFE_MOD = 0x55;
+    SAFE_MOD = 0xAA;
+    CLOCK_CFG = (CLOCK_CFG & ~MASK_SYS_CK_SEL) | (clockSlow ? CLOCK_SEL_SLOW : clockSelFast);
+    SAFE_MOD = 0;
+    EA       = 1;
+}
+#pragma restore
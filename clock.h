@@ -0,0 +1,37 @@
+#pragma once
+
+#include <ch554.h>
+#include <stdint.h>
+
+#include "scheduler.h"
+
+// System clock, FREQ_SYS while there is work, CLOCK_SLOW while the main loop only waits.
+// - The WS2812 timing, the UART baud rate and the tone periods are built for FREQ_SYS, so frames,
+//   UART traffic and melodies run at the fast clock.
+// - The clock only switches in timer0_interrupt(), right after a timer0 period, and the next period
+//   takes TIMER0_STEPS_SLOW steps of TH0 in place of TIMER0_STEPS. Both last TIMER0_PERIOD_US, so
+//   systemTime keeps counting milliseconds.
+// - At 3 MHz a step of TH0 takes 1024µs, 1 step a period. At 750 kHz it would take 4096µs, and
+//   systemTime would move in steps of 4.
+#define CLOCK_SLOW         3000000
+#define CLOCK_SLOW_DIVIDER (FREQ_SYS / CLOCK_SLOW)  // Timer0 clocks at FREQ_SYS for 1 at CLOCK_SLOW
+#define TIMER0_STEPS_SLOW  (TIMER0_STEPS / CLOCK_SLOW_DIVIDER)
+
+// Only FREQ_SYS that are a multiple of CLOCK_SLOW can switch, 16 and 32 MHz stay fast.
+#if FREQ_SYS % CLOCK_SLOW == 0 && FREQ_SYS > CLOCK_SLOW
+#define CLOCK_SCALING
+
+#if TIMER0_STEPS != CLOCK_SLOW_DIVIDER
+#error "The timer0 period must be the same at FREQ_SYS and CLOCK_SLOW"
+#endif
+#endif
+
+extern volatile __bit clockSlow;  // The clock runs at CLOCK_SLOW
+
+void initClock();
+// Ask for the slow or the fast clock from the next tick on.
+void setSlowClock(__bit slow);
+// Switch to the fast clock, waits up to 1ms for the next tick.
+void waitForFastClock();
+// Runs in timer0_interrupt() before the reload, applies the clock asked for.
+void updateClock();
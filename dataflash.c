@@ -0,0 +1,52 @@
+#include "dataflash.h"
+
+// The DataFlash is at DATA_FLASH_ADDR in code memory, on even addresses only.
+
+uint8_t readDataFlash(uint8_t address)
+{
+    ROM_ADDR_H = DATA_FLASH_ADDR >> 8;
+    ROM_ADDR_L = address << 1;
+    ROM_CTRL   = ROM_CMD_READ;
+    return ROM_DATA_L;
+}
+
+// The CPU stalls while each byte is written, timer0 and the UART keep going but their interrupts
+// wait, so keep `length` short.
+__bit writeDataFlash(uint8_t address, __xdata const uint8_t *data, uint8_t length)
+{
+    const __bit ea = EA;
+    __bit       ok = 1;
+
+    // The safe mode lasts a few cycles, nothing may run between its 2 keys.
+    EA       = 0;
+    SAFE_MOD = 0x55;
+    SAFE_MOD = 0xAA;
+    GLOBAL_CFG |= bDATA_WE;
+    SAFE_MOD = 0;
+    EA       = ea;
+
+    ROM_ADDR_H = DATA_FLASH_ADDR >> 8;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        ROM_ADDR_L = (address + i) << 1;
+        ROM_DATA_L = data[i];
+        if (ROM_STATUS & bROM_ADDR_OK)
+        {
+            ROM_CTRL = ROM_CMD_WRITE;
+        }
+        if ((ROM_STATUS ^ bROM_ADDR_OK) > 0)
+        {
+            ok = 0;
+            break;
+        }
+    }
+
+    EA       = 0;
+    SAFE_MOD = 0x55;
+    SAFE_MOD = 0xAA;
+    GLOBAL_CFG &= ~bDATA_WE;
+    SAFE_MOD = 0;
+    EA       = ea;
+
+    return ok;
+}
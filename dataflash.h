@@ -0,0 +1,12 @@
+#pragma once
+
+#include <ch554.h>
+#include <stdint.h>
+
+// The 128-byte DataFlash of the CH552, bytes are read and written one at a time, no erase.
+// Rated for 10,000 writes per byte, see state.h for how they are spread.
+#define DATA_FLASH_SIZE 128
+
+uint8_t readDataFlash(uint8_t address);
+// Returns 0 if a byte failed to write.
+__bit   writeDataFlash(uint8_t address, __xdata const uint8_t *data, uint8_t length);
@@ -0,0 +1,247 @@
+#include "effects.h"
+#include "led.h"
+
+// A quarter sine, QUARTER_SINE[i] = round(255 x sin(i x pi / 128)), i = 0 - 64.
+__code const uint8_t QUARTER_SINE[65] = {
+    0,   6,   13,  19,  25,  31,  37,  44,  50,  56,  62,  68,  74,  80,  86,  92,   //
+    98,  103, 109, 115, 120, 126, 131, 136, 142, 147, 152, 157, 162, 167, 171, 176,  //
+    180, 185, 189, 193, 197, 201, 205, 208, 212, 215, 219, 222, 225, 228, 231, 233,  //
+    236, 238, 240, 242, 244, 246, 247, 249, 250, 251, 252, 253, 254, 254, 255, 255,  //
+    255,
+};
+
+// Hues run 0 - HUE_STEPS - 1, 3 sectors of 64 from red to green to blue and back to red.
+#define HUE_STEPS 192
+
+#define RAINBOW_SPREAD 7  // Hue steps between 2 LEDs, 27 LEDs show the whole wheel
+#define RAINBOW_DIM    2  // Shift of the LEDs between the bright ones
+#define COMET_TAIL     6  // LEDs lit behind the head, each half as bright as the one before
+#define COMET_LAP_HUE  40  // Hue steps the comet moves on every lap
+#define TWINKLE_CHANCE 2  // In 256, a dark LED lighting up in a step
+#define NIGHT_BLUE     16
+#define FIRE_COOLING   0x1F  // Mask of the heat an LED loses in a step
+#define FIRE_SPARKING  120   // In 256, a spark in a step
+
+__data uint8_t randomState[4] = {0x5A, 0x3C, 0xA5, 0xC3};  // random8(), never all 0
+
+__data uint8_t  effect      = EFFECT_RAINBOW;
+__data uint8_t  effectFrame = 0;  // Steps since startEffect()
+__data uint8_t  effectHue;        // Hue of LED 0 or of the comet
+__data LedIndex effectHead;       // Comet head, or the first bright LED of the chase
+
+// Twinkle phase or fire heat of every LED. The GRB build keeps it in the fade fractions of led.c:
+// an effect draws every LED with putRGB(), which stops its fade, and nothing fades while it runs.
+// fadeRGB() sets the fractions again before the next fade.
+#ifdef LED_INDEXED
+__xdata uint8_t effectState[LED_COUNT];
+#else
+extern __xdata uint8_t fadeFraction[LED_COUNT * 3];
+#define effectState fadeFraction
+#endif
+
+// The oldest byte of the state is mixed into t, the others move down and the newest one is mixed
+// with t into a new byte.
+uint8_t random8()
+{
+    const uint8_t t = randomState[0] ^ (randomState[0] << 4);
+
+    randomState[0] = randomState[1];
+    randomState[1] = randomState[2];
+    randomState[2] = randomState[3];
+    randomState[3] = randomState[2] ^ t ^ (randomState[2] >> 1) ^ (t << 1);
+    return randomState[3];
+}
+
+// `hue` at full saturation, each component shifted right by `shift`. The 2 components of a sector
+// are a quarter sine and its cosine: once squared by the gamma curve they add up to the same
+// brightness all round the wheel.
+static void putHue(uint8_t hue, uint8_t shift)
+{
+    const uint8_t rising  = QUARTER_SINE[hue & 0x3F] >> shift;
+    const uint8_t falling = QUARTER_SINE[64 - (hue & 0x3F)] >> shift;
+
+    if (hue < 64)
+    {
+        putRGB(falling, rising, 0);
+    }
+    else if (hue < 128)
+    {
+        putRGB(0, falling, rising);
+    }
+    else
+    {
+        putRGB(rising, 0, falling);
+    }
+}
+
+// Black, red, yellow then white, 64 heat levels each.
+static void putHeat(uint8_t heat)
+{
+    const uint8_t ramp = (heat & 0x3F) << 2;
+
+    if (heat < 64)
+    {
+        putRGB(ramp, 0, 0);
+    }
+    else if (heat < 128)
+    {
+        putRGB(FULL, ramp, 0);
+    }
+    else if (heat < 192)
+    {
+        putRGB(FULL, FULL, ramp);
+    }
+    else
+    {
+        putRGB(FULL, FULL, FULL);
+    }
+}
+
+static uint8_t nextHue(uint8_t hue, uint8_t steps)
+{
+    hue += steps;
+    return hue >= HUE_STEPS ? hue - HUE_STEPS : hue;
+}
+
+// The wheel spread over the strip turns 1 step a frame, every third LED is bright and the bright
+// ones move 1 LED every 4 frames.
+static void drawRainbow()
+{
+    uint8_t hue = effectHue;
+    uint8_t dim = (uint8_t)effectHead;  // LEDs before the next bright one
+
+    for (LedIndex i = 0; i < LED_COUNT; i++)
+    {
+        putHue(hue, dim ? RAINBOW_DIM : 0);
+        dim = dim ? dim - 1 : 2;
+        hue = nextHue(hue, RAINBOW_SPREAD);
+    }
+
+    effectHue = nextHue(effectHue, 1);
+    if ((effectFrame & 0x03) == 0x03)
+    {
+        effectHead = effectHead ? effectHead - 1 : 2;
+    }
+}
+
+// The head moves 1 LED a frame, a lap of 27 LEDs in 0.54s, and changes colour on every lap.
+static void drawComet()
+{
+    LedIndex behind = effectHead;  // LEDs from LED i back to the head, round the strip
+
+    for (LedIndex i = 0; i < LED_COUNT; i++)
+    {
+        if (behind < COMET_TAIL)
+        {
+            putHue(effectHue, behind);
+        }
+        else
+        {
+            putRGB(0, 0, 0);
+        }
+        behind = behind ? behind - 1 : LED_COUNT - 1;
+    }
+
+    if (++effectHead == LED_COUNT)
+    {
+        effectHead = 0;
+        effectHue  = nextHue(effectHue, COMET_LAP_HUE);
+    }
+}
+
+// A star lives 64 frames, its phase goes up in odd steps from 1 to 127 along half a sine.
+static void drawTwinkle()
+{
+    __xdata uint8_t *phase = effectState;
+
+    for (LedIndex i = 0; i < LED_COUNT; i++, phase++)
+    {
+        if (!*phase)
+        {
+            if (random8() >= TWINKLE_CHANCE)
+            {
+                putRGB(0, 0, NIGHT_BLUE);
+                continue;
+            }
+            *phase = 1;
+        }
+
+        const uint8_t bright = QUARTER_SINE[*phase <= 64 ? *phase : 128 - *phase];
+        const uint8_t blue   = bright >> 1;
+
+        putRGB(bright, bright - (bright >> 3), blue < NIGHT_BLUE ? NIGHT_BLUE : blue);
+        *phase += 2;
+        if (*phase > 128)
+        {
+            *phase = 0;
+        }
+    }
+}
+
+// Every LED cools a little, heat drifts up the strip as an average of the 3 LEDs below, and
+// sparks flare up in the first 4.
+static void drawFire()
+{
+    __xdata uint8_t *heat = effectState;
+
+    for (LedIndex i = 0; i < LED_COUNT; i++)
+    {
+        const uint8_t cool = random8() & FIRE_COOLING;
+
+        heat[i] = heat[i] > cool ? heat[i] - cool : 0;
+    }
+
+    for (heat = &effectState[LED_COUNT - 1]; heat != &effectState[2]; heat--)
+    {
+        heat[0] = ((uint16_t)heat[-1] + heat[-2] + heat[-2] + heat[-3]) >> 2;
+    }
+
+    if (random8() < FIRE_SPARKING)
+    {
+        heat                = &effectState[random8() & 0x03];
+        const uint8_t spark = 160 + (random8() & 0x5F);
+
+        *heat = *heat > 0xFF - spark ? 0xFF : *heat + spark;
+    }
+
+    heat = effectState;
+    for (LedIndex i = 0; i < LED_COUNT; i++, heat++)
+    {
+        putHeat(*heat);
+    }
+}
+
+void startEffect(uint8_t index)
+{
+    effect      = index;
+    effectFrame = 0;
+    effectHue   = 0;
+    effectHead  = 0;
+    for (LedIndex i = 0; i < LED_COUNT; i++)
+    {
+        effectState[i] = 0;
+    }
+}
+
+// Draw the next frame of the effect, runs every EFFECT_INTERVAL ms.
+void stepEffect()
+{
+    seekRGB(0);
+    switch (effect)
+    {
+        case EFFECT_RAINBOW:
+            drawRainbow();
+            break;
+        case EFFECT_COMET:
+            drawComet();
+            break;
+        case EFFECT_TWINKLE:
+            drawTwinkle();
+            break;
+        case EFFECT_FIRE:
+            drawFire();
+            break;
+    }
+
+    effectFrame++;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <ch554.h>
+#include <stdint.h>
+
+// Procedural light effects, drawn into the background layer by stepEffect() every EFFECT_INTERVAL ms.
+// Light modes LIGHT_EFFECT and up of main.c play them, in the order of the numbers below.
+#define EFFECT_RAINBOW 0  // Rainbow moving along the strip, every third LED bright, chasing
+#define EFFECT_COMET   1  // A head running round the strip with a tail halving every LED
+#define EFFECT_TWINKLE 2  // Warm stars coming and going on a night blue
+#define EFFECT_FIRE    3  // Heat rising from LED 0, cooling and flickering
+#define EFFECT_COUNT   4
+
+#define EFFECT_INTERVAL 20  // 50 frames a second
+
+// Frame budget at 12 MHz: 20ms is 240000 clocks. The frame takes 0.8ms with interrupts off for
+// 27 LEDs, and renderFrame() less than that, so an effect may use EFFECT_BUDGET clocks per step,
+// putRGB() of every LED included, leaving the rest to the keys, UART and other tasks. At the 3 MHz
+// clock of clock.h a step takes 4 times as long, still within the interval.
+//
+// Estimated clocks per step for 27 LEDs, counted from the work per LED, not measured:
+//
+//   rainbow chase  12000   1 wheel lookup per LED
+//   comet          10000   1 wheel lookup per lit LED, a shift per LED of the tail
+//   twinkle        14000   1 random8() per dark LED, 1 sine lookup per lit one
+//   fire           20000   2 random8() and a 4-tap average per LED, 1 heat lookup
+//
+// The bench cases stepEffect_* are there to replace them with counts, see bench/run_bench.py for
+// what those are worth. The per-LED loops only add, shift, compare and look tables up, no multiply
+// or divide, which SDCC turns into library calls past 8 bits. They draw with putRGB(), which walks
+// the GRB background layer with a pointer, where setRGB() works out index x 3 for every LED.
+#define EFFECT_BUDGET 24000
+
+// Pseudo-random byte, an 8-bit xorshift over 4 bytes of state, period 2^32 - 1.
+uint8_t random8();
+
+void startEffect(uint8_t index);
+void stepEffect();
@@ -0,0 +1,19 @@
+#include "gamma.h"
+
+// Gamma 2 curve, scaled to the maximum value of every brightness level.
+//   output = round(LEVEL_MAX x (colour / 252)^2)
+// The colour keeps its 6 high bits, leaving the 2 low bits of the index to the level, so
+// bigBangWS2812() looks a byte up with a single `anl` + `orl` and no shift.
+#define LEVEL_MAX(level) ((level) == 0 ? 5 : (level) == 1 ? 12 : (level) == 2 ? 28 : 64)
+
+#define GAMMA(i)                                                                      \
+    ((uint8_t)((LEVEL_MAX((i) & 0x03) * (uint32_t)((i) & 0xFC) * ((i) & 0xFC) + 31752) \
+               / 63504))  // 252 x 252 = 63504
+
+#define GAMMA_4(i)  GAMMA(i), GAMMA((i) + 1), GAMMA((i) + 2), GAMMA((i) + 3)
+#define GAMMA_16(i) GAMMA_4(i), GAMMA_4((i) + 4), GAMMA_4((i) + 8), GAMMA_4((i) + 12)
+#define GAMMA_64(i) GAMMA_16(i), GAMMA_16((i) + 16), GAMMA_16((i) + 32), GAMMA_16((i) + 48)
+
+__code const uint8_t GAMMA_TABLE[256] = {
+    GAMMA_64(0), GAMMA_64(64), GAMMA_64(128), GAMMA_64(192)  //
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <ch554.h>
+#include <stdint.h>
+
+// Number of brightness levels, must be a power of 2 up to 4.
+#define BRIGHTNESS_LEVELS 4
+
+// Value sent to the WS2812 for a colour component, indexed by (colour & 0xFC) | brightness level.
+extern __code const uint8_t GAMMA_TABLE[256];
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <ch554.h>
+#include "../animation.h"
+#include "../bitbang.h"
+#include "../led.h"
+#include "../uart.h"
+#include "sim.h"
+
+__data uint8_t ledBrightness = 0;
+
+static uint8_t wire[65536 * 3];
+
+// Records the frame as sent on the wire and spends the time the strip takes to receive it, 24 bits
+// of 1.25µs per LED. RI is polled before every LED like the firmware does.
+static void sendWire(uint16_t ledCount)
+{
+    if (ledCount)
+    {
+        simFrame(ledCount, wire);
+    }
+
+    uartPendingCount = 0;
+    for (unsigned i = 0; i < ledCount; i++)
+    {
+        if (RI)
+        {
+            RI = 0;
+            if (uartPendingCount < UART_PENDING_SIZE)
+            {
+                uartPending[uartPendingCount++] = (uint8_t)SBUF;
+            }
+        }
+        simDelay(24 * 125 * (FREQ_SYS / 1000000) / 100);
+    }
+}
+
+// Host replacements of the WS2812 transmitters.
+void bigBangWS2812(uint16_t ledCount, __xdata uint8_t* ledData)
+{
+#ifdef LED_INDEXED
+    for (unsigned i = 0; i < ledCount; i++)
+    {
+        const uint8_t entry = i & 1 ? ledData[i / 2] >> 4 : ledData[i / 2] & 0x0F;
+
+        for (unsigned c = 0; c < 3; c++)
+        {
+            wire[i * 3 + c] = ledWire[entry * 3 + c];
+        }
+    }
+#else
+    for (unsigned i = 0; i < ledCount * 3u; i++)
+    {
+        wire[i] = GAMMA_TABLE[(ledData[i] & 0xFC) | ledBrightness];
+    }
+#endif
+
+    sendWire(ledCount);
+}
+
+__code const uint8_t *bigBangWS2812Code(__code const uint8_t *frame)
+{
+    unsigned ledCount = 0;
+
+    for (uint8_t run; (run = *frame++) != ANIM_FRAME_END;)
+    {
+        for (unsigned i = 0; i < (run & 0x7Fu); i++, ledCount++)
+        {
+            const uint8_t *color = run & 0x80 ? frame + i * 3 : frame;
+
+            for (unsigned c = 0; c < 3; c++)
+            {
+                wire[ledCount * 3 + c] = GAMMA_TABLE[(color[c] & 0xFC) | ledBrightness];
+            }
+        }
+        frame += run & 0x80 ? (run & 0x7F) * 3 : 3;
+    }
+
+    sendWire(ledCount);
+    return frame;
+}
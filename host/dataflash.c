@@ -0,0 +1,17 @@
+#include <stdint.h>
+#include <ch554.h>
+#include "../dataflash.h"
+#include "sim.h"
+
+// Host replacement of the DataFlash access, the bytes live in the virtual MCU, see simWriteDataFlash().
+
+uint8_t readDataFlash(uint8_t address)
+{
+    return simDataFlash[address % DATA_FLASH_SIZE];
+}
+
+__bit writeDataFlash(uint8_t address, __xdata const uint8_t *data, uint8_t length)
+{
+    simWriteDataFlash(address, data, length);
+    return 1;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+// Host stub of ch554.h, just enough of the CH552 for the firmware to build with gcc/clang.
+// - SFRs and SFR bits are plain variables owned by the virtual MCU in sim.c.
+// - SBITs declared by the firmware are registered in the `sim_sbits` section, so the virtual MCU
+//   can map them back to their port pins.
+
+#include <stdint.h>
+
+// SDCC keywords
+#define __data
+#define __idata
+#define __xdata
+#define __code
+#define __bit          uint8_t
+#define __interrupt(n)
+#define __using(n)
+
+typedef struct
+{
+    volatile uint8_t *value;
+    uint8_t           address;
+    uint8_t           bit;
+} SimSbit;
+
+#define SBIT(name, addr, bit) \
+    volatile uint8_t name;    \
+    static const SimSbit simSbit_##name __attribute__((used, section("sim_sbits"))) = {&name, addr, bit}
+
+// Ports
+extern volatile uint8_t P1, P1_MOD_OC, P1_DIR_PU;
+extern volatile uint8_t P3, P3_MOD_OC, P3_DIR_PU;
+
+// System
+extern volatile uint8_t GLOBAL_CFG, PCON, PIN_FUNC, CLOCK_CFG, SAFE_MOD;
+#define MASK_SYS_CK_SEL 0x07  // 187.5 kHz, 750 kHz, 3, 6, 12, 16, 24, 32 MHz
+#define bLDO3V3_OFF  0x80
+#define SMOD         0x80
+#define bUART0_PIN_X 0x10
+
+// Interrupts
+extern volatile uint8_t EA, ET0, ET2, IE_ADC, ES, PS;
+
+// Timer0
+extern volatile uint8_t TMOD, TH0, TL0, TR0;
+#define bT0_M0 0x01
+
+// Timer1
+extern volatile uint8_t TH1, TL1, TR1;
+#define bT1_M1 0x20
+
+// Timer2
+extern volatile uint8_t T2CON, T2MOD, RCAP2L, RCAP2H, TL2, TH2, TR2, TF2;
+#define bTMR_CLK 0x80
+#define bT1_CLK  0x20
+
+// UART0
+// SBUF has 9 bits here: the virtual MCU sets bit 8 on the received byte, a write by the firmware
+// clears it, that is how a transmission is told from a read.
+extern volatile uint8_t  SCON, RI, TI;
+extern volatile uint16_t SBUF;
+
+// ADC, a conversion takes 96 Fosc cycles (fast mode) after ADC_START is set.
+extern volatile uint8_t ADC_CFG, ADC_DATA, ADC_CHAN0, ADC_CHAN1, ADC_START, ADC_IF;
+#define bADC_CLK  0x01
+#define bADC_EN   0x08
+#define bAIN3     0x04
+
+// Interrupt numbers
+#define INT_NO_TMR0  1
+#define INT_NO_UART0 4
+#define INT_NO_TMR2  5
+#define INT_NO_ADC   9
@@ -0,0 +1,9 @@
+#pragma once
+
+// Host stub of debug.h, the delays advance the virtual clock of sim.c.
+
+#include <stdint.h>
+
+void CfgFsys();
+void mDelayuS(uint16_t n);
+void mDelaymS(uint16_t n);
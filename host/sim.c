@@ -0,0 +1,854 @@
+// Virtual CH552 for the host build.
+//
+// The firmware is compiled with `-finstrument-functions`, so every function call it makes lands in
+// __cyg_profile_func_enter() below. Each call costs a fixed number of cycles of virtual time, and
+// the timers, interrupts and scripted inputs are run against that clock. Nothing depends on the
+// host's real time, a run is reproducible cycle by cycle.
+//
+// Usage: subway-sim [-o trace] [-c golden] [-t call_us] [-f dataflash] [-d drift_ms] script
+//
+// With -d, the run fails when systemTime ends more than drift_ms away from the simulated time.
+//
+// The system clock follows CLOCK_CFG, the timers, UART0, the ADC and the call cost slow down with it.
+// A byte received at a clock other than FREQ_SYS arrives inverted, standing in for the garbage a
+// wrong baud rate gives.
+//
+// The DataFlash starts erased, or with the contents of the -f file, which is updated at the end.
+//
+// Script, one event per line, times in milliseconds since reset:
+//     # comment
+//     1000 press A       - Pull key A..E low
+//     1100 release A     - Release the key
+//     5000 adc 110       - Value returned by the next ADC conversions
+//     6000 uart a5 05 00 05
+//                        - Bytes received by UART0 back to back from that time, in hex
+//     9000 end           - Stop the run
+//
+// Trace, times in µs since reset:
+//     <time> frame <count> <GRB bytes in hex>
+//     <time> buzzer <0|1>
+//     <time> uart <bytes sent by UART0 less than 1ms apart, in hex>
+//     <time> uart overrun   - A byte was received before the previous one was read
+//     <time> flash <address> <bytes written to the DataFlash, in hex>
+//     <time> shutdown
+//     <time> end
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ch554.h>
+#include <debug.h>
+
+#include "sim.h"
+
+#define CYCLES_PER_US (FREQ_SYS / 1000000)
+#define CYCLES_PER_MS (FREQ_SYS / 1000)
+
+// Cycles from a timer overflow to the first statement of its ISR: the vector jump, and SDCC's
+// prologue pushing the registers the ISR uses.
+#define INTERRUPT_ENTRY_CYCLES 40
+
+// Firmware entry points, `main` is renamed by the Makefile.
+void firmwareMain(void);
+unsigned char _sdcc_external_startup(void);
+void timer0_interrupt(void);
+void timer2_interrupt(void);
+void adc_interrupt(void);
+void uart0_interrupt(void);
+void waitForTick(uint8_t tick);
+extern volatile uint16_t systemTime;
+
+// SFRs
+volatile uint8_t P1 = 0xFF, P1_MOD_OC = 0xFF, P1_DIR_PU = 0xFF;
+volatile uint8_t P3 = 0xFF, P3_MOD_OC = 0xFF, P3_DIR_PU = 0xFF;
+volatile uint8_t GLOBAL_CFG, PCON, PIN_FUNC, CLOCK_CFG, SAFE_MOD;
+volatile uint8_t EA, ET0, ET2, IE_ADC, ES, PS;
+volatile uint8_t TMOD, TH0, TL0, TR0;
+volatile uint8_t TH1, TL1, TR1;
+volatile uint8_t  SCON, RI, TI;
+volatile uint16_t SBUF = 0x100;
+volatile uint8_t T2CON, T2MOD, RCAP2L, RCAP2H, TL2, TH2, TR2, TF2;
+volatile uint8_t ADC_CFG, ADC_DATA, ADC_CHAN0, ADC_CHAN1, ADC_START, ADC_IF;
+
+static uint8_t  adcValue = 128;         // ~3.35V battery
+static uint64_t adcDue   = UINT64_MAX;  // End of the running conversion
+
+// UART0
+static uint8_t  rxBytes[65536];  // Scripted bytes
+static size_t   rxCount;
+static size_t   rxNext;
+static uint64_t rxDue = UINT64_MAX;  // Next byte received
+static uint8_t  rxLast;
+static uint64_t txDue = UINT64_MAX;  // End of the byte being sent
+static uint64_t txEnd;               // End of the last byte sent
+static uint64_t txStart;             // Start of the buffered `uart` trace line
+static char     txText[2 * 1024 + 1];
+static size_t   txLength;
+
+// DataFlash
+uint8_t            simDataFlash[128];
+static const char *flashPath;
+
+// SBITs declared by the firmware
+extern const SimSbit __start_sim_sbits[];
+extern const SimSbit __stop_sim_sbits[];
+
+// Timers, counting at MCU_Frequency/12
+typedef struct
+{
+    volatile uint8_t *run;
+    volatile uint8_t *enable;
+    volatile uint8_t *th;
+    volatile uint8_t *tl;
+    volatile uint8_t *rcapH;  // NULL in 16-bit mode without reload
+    volatile uint8_t *rcapL;
+    void (*isr)(void);
+    int      armed;
+    int      pending;  // Overflowed, interrupt not served yet
+    uint64_t due;      // Next overflow
+} Timer;
+
+static Timer timers[] = {
+    {&TR0, &ET0, &TH0, &TL0, NULL, NULL, timer0_interrupt},
+    {&TR2, &ET2, &TH2, &TL2, &RCAP2H, &RCAP2L, timer2_interrupt},
+};
+
+#define TIMER_COUNT (sizeof(timers) / sizeof(timers[0]))
+
+// Scripted inputs
+typedef struct
+{
+    uint64_t time;
+    char     command[16];
+    char     arg[512];
+} Event;
+
+static Event  *events;
+static size_t  eventCount;
+static size_t  nextEvent;
+static uint64_t now;       // Cycles since reset
+static uint64_t callCost = 20 * CYCLES_PER_US;
+static int      inInterrupt;
+static int      running;
+static uint8_t  pins3 = 0xFF;  // P3 as driven by the firmware's SBITs
+static FILE    *trace;
+static char    *traceBuffer;
+static size_t   traceSize;
+static uint64_t idleSince;
+static uint64_t idleCycles;  // Cycles spent in waitForTick()
+static uint64_t systemTimeMs;  // systemTime without wrapping, compared with `now` for the drift
+static uint16_t lastSystemTime;
+
+static void finish(const char *reason);
+static void overflowTimers();
+
+static uint16_t counterOf(const Timer *t)
+{
+    return (uint16_t)(*t->th << 8 | *t->tl);
+}
+
+// System clock, cycles of FREQ_SYS per cycle of the clock selected by CLOCK_CFG
+static uint64_t clockDivider = 1;
+static uint64_t slowCycles;  // Cycles spent with clockDivider > 1
+static uint64_t slowSince;
+
+static uint64_t selectedDivider()
+{
+    static const uint32_t frequencies[] = {187500, 750000, 3000000, 6000000, 12000000, 16000000, 24000000, 32000000};
+    const uint32_t        frequency     = frequencies[CLOCK_CFG & MASK_SYS_CK_SEL];
+
+    if (frequency > FREQ_SYS || FREQ_SYS % frequency)
+    {
+        fprintf(stderr, "clock of %u Hz is not modelled with FREQ_SYS %u\n", frequency, FREQ_SYS);
+        exit(2);
+    }
+    return FREQ_SYS / frequency;
+}
+
+static uint64_t cyclesUntilOverflow(uint16_t counter)
+{
+    return (uint64_t)(0x10000 - counter) * 12 * clockDivider;
+}
+
+// P3 output pins driven through SBITs
+static const SimSbit *port3[8];
+static size_t         port3Count;
+
+static void findPins()
+{
+    for (const SimSbit *s = __start_sim_sbits; s < __stop_sim_sbits; s++)
+    {
+        if (s->address == 0xB0 && port3Count < 8)
+        {
+            port3[port3Count++] = s;
+        }
+    }
+}
+
+// Write the buffered `uart` line once the UART has been idle for 1ms, or when `force` is set.
+static void endUartLine(int force)
+{
+    if (txLength && (force || now > txEnd + FREQ_SYS / 1000))
+    {
+        fprintf(trace, "%" PRIu64 " uart %s\n", txStart / CYCLES_PER_US, txText);
+        txLength = 0;
+    }
+}
+
+static void tracePins()
+{
+    uint8_t pins = 0xFF;
+    for (size_t i = 0; i < port3Count; i++)
+    {
+        if (!*port3[i]->value)
+        {
+            pins &= ~(1 << port3[i]->bit);
+        }
+    }
+
+    const uint8_t changed = pins ^ pins3;
+    pins3                 = pins;
+
+    if (changed & (1 << 4))
+    {
+        endUartLine(0);
+        fprintf(trace, "%" PRIu64 " buzzer %d\n", now / CYCLES_PER_US, (pins >> 4) & 1);
+    }
+    if ((changed & (1 << 3)) && (pins & (1 << 3)))
+    {
+        finish("shutdown");
+    }
+}
+
+// Cycles of a 10-bit UART0 frame, from timer1 in 8-bit auto-reload mode.
+static uint64_t uartByteCycles()
+{
+    const uint64_t clock = (T2MOD & bTMR_CLK) && (T2MOD & bT1_CLK) ? 1 : 12;
+    return 10 * (PCON & SMOD ? 16 : 32) * (256 - TH1) * clock;
+}
+
+static void traceUart(const char *text)
+{
+    endUartLine(0);
+    fprintf(trace, "%" PRIu64 " uart %s\n", now / CYCLES_PER_US, text);
+}
+
+// A byte written to SBUF by the firmware, see ch554.h.
+static void checkTx()
+{
+    if (SBUF & 0x100)
+    {
+        return;
+    }
+
+    const uint8_t value = SBUF;
+    SBUF                = 0x100 | rxLast;
+
+    // Bytes sent less than 1ms apart share a line, a reply delayed by a frame stays in one piece.
+    endUartLine(0);
+    if (!txLength)
+    {
+        txStart = now;
+    }
+    if (txLength + 2 < sizeof(txText))
+    {
+        txLength += sprintf(txText + txLength, "%02x", value);
+    }
+
+    txDue = now + uartByteCycles() * clockDivider;
+    txEnd = txDue;
+}
+
+static uint64_t nextUartDue()
+{
+    return rxDue < txDue ? rxDue : txDue;
+}
+
+static void completeUart()
+{
+    if (rxDue <= now)
+    {
+        if (RI)
+        {
+            traceUart("overrun");
+        }
+        else
+        {
+            rxLast = clockDivider == 1 ? rxBytes[rxNext] : (uint8_t)~rxBytes[rxNext];
+            SBUF   = 0x100 | rxLast;
+            RI     = 1;
+        }
+        rxNext++;
+        rxDue = rxNext < rxCount ? rxDue + uartByteCycles() : UINT64_MAX;
+    }
+    if (txDue <= now)
+    {
+        TI    = 1;
+        txDue = UINT64_MAX;
+    }
+}
+
+// Show the running count in TH/TL, as profileClock() reads it between overflows.
+static void updateCounters()
+{
+    for (size_t i = 0; i < TIMER_COUNT; i++)
+    {
+        Timer *t = &timers[i];
+        if (t->armed && *t->run)
+        {
+            const uint64_t tick    = 12 * clockDivider;
+            const uint16_t counter = (uint16_t)(0x10000 - (t->due - now + tick - 1) / tick);
+
+            *t->th = counter >> 8;
+            *t->tl = counter & 0xFF;
+        }
+    }
+}
+
+// The firmware switched the clock, the timers go on from their count at the new rate.
+static void updateClock()
+{
+    const uint64_t divider = selectedDivider();
+    if (divider == clockDivider)
+    {
+        return;
+    }
+
+    if (clockDivider > 1)
+    {
+        slowCycles += now - slowSince;
+    }
+    slowSince = now;
+
+    // The prescaler clocks left to the overflow, the part of a count included, run at the new rate.
+    for (size_t i = 0; i < TIMER_COUNT; i++)
+    {
+        Timer *t = &timers[i];
+        if (t->armed)
+        {
+            t->due = now + (t->due - now) * divider / clockDivider;
+        }
+    }
+    clockDivider = divider;
+}
+
+// Serve pending interrupts, UART0 is set to high priority, then Timer0 has the higher natural
+// priority.
+static void serveInterrupts()
+{
+    checkTx();
+
+    if (inInterrupt || !EA)
+    {
+        return;
+    }
+
+    if (ES && (RI || TI))
+    {
+        inInterrupt = 1;
+        uart0_interrupt();
+        inInterrupt = 0;
+        checkTx();
+    }
+
+    for (size_t i = 0; i < TIMER_COUNT; i++)
+    {
+        Timer *t = &timers[i];
+        if (t->pending && *t->enable)
+        {
+            // The timers count on while the CPU vectors and the ISR saves its registers, and can
+            // overflow again meanwhile.
+            t->pending = 0;
+            now += INTERRUPT_ENTRY_CYCLES * clockDivider;
+            overflowTimers();
+            updateCounters();
+            const uint16_t counter = counterOf(t);
+
+            inInterrupt = 1;
+            t->isr();
+            inInterrupt = 0;
+
+            // The ISR wrote the count, e.g. Timer0 reloading TH0/TL0. The prescaler goes on, the part of
+            // a count already elapsed stays. A count written behind the running one overflows at once.
+            if (t->armed && counterOf(t) != counter)
+            {
+                const int64_t due = (int64_t)t->due + (int64_t)cyclesUntilOverflow(counterOf(t)) -
+                                    (int64_t)cyclesUntilOverflow(counter);
+                t->due = due > (int64_t)now ? (uint64_t)due : now;
+            }
+            updateClock();
+
+            systemTimeMs += (uint16_t)(systemTime - lastSystemTime);
+            lastSystemTime = systemTime;
+
+            tracePins();
+        }
+    }
+
+    if (ADC_IF && IE_ADC)
+    {
+        inInterrupt = 1;
+        adc_interrupt();
+        inInterrupt = 0;
+    }
+}
+
+static uint64_t nextTimerDue()
+{
+    uint64_t due = UINT64_MAX;
+    for (size_t i = 0; i < TIMER_COUNT; i++)
+    {
+        Timer *t = &timers[i];
+        if (!*t->run)
+        {
+            t->armed = 0;
+        }
+        else if (!t->armed)
+        {
+            t->armed = 1;
+            t->due   = now + cyclesUntilOverflow(counterOf(t));
+        }
+
+        if (t->armed && t->due < due)
+        {
+            due = t->due;
+        }
+    }
+    return due;
+}
+
+static uint64_t nextAdcDue()
+{
+    if (!ADC_START)
+    {
+        adcDue = UINT64_MAX;
+    }
+    else if (adcDue == UINT64_MAX)
+    {
+        adcDue = now + 96 * clockDivider;  // 96 Fosc cycles in fast mode
+    }
+    return adcDue;
+}
+
+static void completeAdc()
+{
+    if (adcDue <= now)
+    {
+        ADC_DATA  = adcValue;
+        ADC_START = 0;
+        ADC_IF    = 1;
+        adcDue    = UINT64_MAX;
+    }
+}
+
+static void overflowTimers()
+{
+    for (size_t i = 0; i < TIMER_COUNT; i++)
+    {
+        Timer *t = &timers[i];
+        if (t->armed && t->due <= now)
+        {
+            // A second overflow before the interrupt is served is lost, as on the chip.
+            t->pending = 1;
+            do
+            {
+                if (t->rcapH)
+                {
+                    *t->th = *t->rcapH;
+                    *t->tl = *t->rcapL;
+                }
+                else
+                {
+                    *t->th = 0;
+                    *t->tl = 0;
+                }
+                t->due += cyclesUntilOverflow(counterOf(t));
+            } while (t->due <= now);
+        }
+    }
+}
+
+static void runEvent(const Event *e)
+{
+    static const char    keys[]    = "ABCDE";
+    static const uint8_t keyPins[] = {1, 7, 6, 5, 4};
+
+    if (!strcmp(e->command, "press") || !strcmp(e->command, "release"))
+    {
+        const char *key = e->arg[0] ? strchr(keys, e->arg[0]) : NULL;
+        if (!key)
+        {
+            fprintf(stderr, "unknown key '%s'\n", e->arg);
+            exit(2);
+        }
+
+        const uint8_t mask = 1 << keyPins[key - keys];
+        if (e->command[0] == 'p')
+        {
+            P1 &= ~mask;
+        }
+        else
+        {
+            P1 |= mask;
+        }
+    }
+    else if (!strcmp(e->command, "adc"))
+    {
+        adcValue = (uint8_t)strtoul(e->arg, NULL, 0);
+    }
+    else if (!strcmp(e->command, "uart"))
+    {
+        const char *p = e->arg;
+        char       *end;
+        for (unsigned long value = strtoul(p, &end, 16); end != p; value = strtoul(p, &end, 16))
+        {
+            if (rxCount == sizeof(rxBytes))
+            {
+                fprintf(stderr, "too many uart bytes\n");
+                exit(2);
+            }
+            rxBytes[rxCount++] = (uint8_t)value;
+            p                  = end;
+        }
+        if (rxDue == UINT64_MAX && rxNext < rxCount)
+        {
+            rxDue = now + uartByteCycles();
+        }
+    }
+    else if (!strcmp(e->command, "end"))
+    {
+        finish("end");
+    }
+    else
+    {
+        fprintf(stderr, "unknown command '%s'\n", e->command);
+        exit(2);
+    }
+}
+
+void simDelay(uint64_t cycles)
+{
+    const uint64_t target = now + cycles;
+
+    serveInterrupts();
+    while (running)
+    {
+        uint64_t next = nextTimerDue();
+        if (nextAdcDue() < next)
+        {
+            next = adcDue;
+        }
+        if (nextUartDue() < next)
+        {
+            next = nextUartDue();
+        }
+        if (nextEvent < eventCount && events[nextEvent].time < next)
+        {
+            next = events[nextEvent].time;
+        }
+        if (next > target)
+        {
+            break;
+        }
+
+        if (next > now)  // An interrupt entry can go past the next event
+        {
+            now = next;
+        }
+        overflowTimers();
+        completeAdc();
+        completeUart();
+        while (nextEvent < eventCount && events[nextEvent].time <= now)
+        {
+            runEvent(&events[nextEvent++]);
+        }
+        serveInterrupts();
+    }
+    if (now < target)  // Unless an interrupt entry went past it
+    {
+        now = target;
+    }
+    updateCounters();
+}
+
+void simWriteDataFlash(uint8_t address, const uint8_t *data, uint8_t length)
+{
+    endUartLine(0);
+    fprintf(trace, "%" PRIu64 " flash %u ", now / CYCLES_PER_US, address);
+    for (unsigned i = 0; i < length; i++)
+    {
+        simDataFlash[(address + i) % sizeof(simDataFlash)] = data[i];
+        fprintf(trace, "%02x", data[i]);
+    }
+    fputc('\n', trace);
+}
+
+static void loadDataFlash()
+{
+    memset(simDataFlash, 0xFF, sizeof(simDataFlash));
+
+    FILE *f = flashPath ? fopen(flashPath, "rb") : NULL;
+    if (f)
+    {
+        if (fread(simDataFlash, 1, sizeof(simDataFlash), f) != sizeof(simDataFlash))
+        {
+            fprintf(stderr, "%s: not a %zu-byte DataFlash image\n", flashPath, sizeof(simDataFlash));
+            exit(2);
+        }
+        fclose(f);
+    }
+}
+
+static void saveDataFlash()
+{
+    if (!flashPath)
+    {
+        return;
+    }
+
+    FILE *f = fopen(flashPath, "wb");
+    if (!f)
+    {
+        perror(flashPath);
+        exit(2);
+    }
+    fwrite(simDataFlash, 1, sizeof(simDataFlash), f);
+    fclose(f);
+}
+
+void simFrame(uint16_t ledCount, const uint8_t *ledData)
+{
+    endUartLine(0);
+    fprintf(trace, "%" PRIu64 " frame %u ", now / CYCLES_PER_US, ledCount);
+    for (unsigned i = 0; i < ledCount * 3u; i++)
+    {
+        fprintf(trace, "%02x", ledData[i]);
+    }
+    fputc('\n', trace);
+}
+
+// debug.h
+void CfgFsys()
+{
+    CLOCK_CFG = (CLOCK_CFG & ~MASK_SYS_CK_SEL) | (FREQ_SYS >= 32000000   ? 7
+                                                 : FREQ_SYS >= 24000000 ? 6
+                                                 : FREQ_SYS >= 16000000 ? 5
+                                                 : FREQ_SYS >= 12000000 ? 4
+                                                 : FREQ_SYS >= 6000000  ? 3
+                                                                        : 2);
+}
+
+void mDelayuS(uint16_t n)
+{
+    simDelay((uint64_t)n * CYCLES_PER_US);
+}
+
+void mDelaymS(uint16_t n)
+{
+    simDelay((uint64_t)n * CYCLES_PER_MS);
+}
+
+// Called on entry of every firmware function.
+void __cyg_profile_func_enter(void *fn, void *site)
+{
+    (void)fn;
+    (void)site;
+
+    if (inInterrupt || !running)
+    {
+        return;
+    }
+
+    if (fn == (void *)waitForTick)
+    {
+        idleSince = now;
+    }
+
+    tracePins();
+    simDelay(callCost * clockDivider);
+}
+
+void __cyg_profile_func_exit(void *fn, void *site)
+{
+    (void)site;
+
+    if (fn == (void *)waitForTick && !inInterrupt)
+    {
+        idleCycles += now - idleSince;
+    }
+}
+
+static void loadScript(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        exit(2);
+    }
+
+    char   line[1024];
+    size_t capacity = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        char *comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = 0;
+        }
+
+        Event    e = {0};
+        uint64_t ms;
+        if (sscanf(line, "%" SCNu64 " %15s %511[^\n]", &ms, e.command, e.arg) < 2)
+        {
+            continue;
+        }
+        e.time = ms * CYCLES_PER_MS;
+
+        if (eventCount == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            events   = realloc(events, capacity * sizeof(Event));
+        }
+        events[eventCount++] = e;
+    }
+    fclose(f);
+}
+
+static const char *outputPath;
+static const char *goldenPath;
+static int64_t     maxDrift = -1;  // ms, -1 to only print the drift
+
+static int compareGolden()
+{
+    FILE *golden = fopen(goldenPath, "r");
+    if (!golden)
+    {
+        perror(goldenPath);
+        return 2;
+    }
+
+    FILE  *actual = fmemopen(traceBuffer, traceSize, "r");
+    char   expected[4096], got[4096];
+    size_t line = 0;
+    int    result = 0;
+    while (!result)
+    {
+        line++;
+        const char *e = fgets(expected, sizeof(expected), golden);
+        const char *g = fgets(got, sizeof(got), actual);
+        if (!e && !g)
+        {
+            break;
+        }
+        if (!e || !g || strcmp(e, g))
+        {
+            fprintf(stderr, "%s:%zu: trace differs\n  expected: %s  got:      %s", goldenPath, line,
+                    e ? e : "<end>\n", g ? g : "<end>\n");
+            result = 1;
+        }
+    }
+    fclose(actual);
+    fclose(golden);
+    return result;
+}
+
+static void finish(const char *reason)
+{
+    // Not part of the trace, it depends on the call cost.
+    fprintf(stderr, "active %" PRIu64 " cycles/s, %.1f%% of the time\n",
+            (now - idleCycles) * FREQ_SYS / (now ? now : 1), 100.0 * (now - idleCycles) / (now ? now : 1));
+    if (clockDivider > 1)
+    {
+        slowCycles += now - slowSince;
+        slowSince = now;
+    }
+    fprintf(stderr, "slow clock %.1f%% of the time\n", 100.0 * slowCycles / (now ? now : 1));
+    const int64_t drift = (int64_t)systemTimeMs - (int64_t)(now / CYCLES_PER_MS);
+    fprintf(stderr, "systemTime drift %+" PRId64 " ms in %" PRIu64 " s\n", drift, now / FREQ_SYS);
+
+    endUartLine(1);
+    fprintf(trace, "%" PRIu64 " %s\n", now / CYCLES_PER_US, reason);
+    fclose(trace);
+    running = 0;
+    saveDataFlash();
+
+    if (outputPath)
+    {
+        FILE *f = fopen(outputPath, "w");
+        if (!f)
+        {
+            perror(outputPath);
+            exit(2);
+        }
+        fwrite(traceBuffer, 1, traceSize, f);
+        fclose(f);
+    }
+    else if (!goldenPath)
+    {
+        fwrite(traceBuffer, 1, traceSize, stdout);
+    }
+
+    if (maxDrift >= 0 && (drift > maxDrift || drift < -maxDrift))
+    {
+        fprintf(stderr, "drift over %" PRId64 " ms\n", maxDrift);
+        exit(1);
+    }
+    exit(goldenPath ? compareGolden() : 0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *script = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc)
+        {
+            outputPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+        {
+            goldenPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+        {
+            callCost = strtoull(argv[++i], NULL, 0) * CYCLES_PER_US;
+        }
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+        {
+            flashPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+        {
+            maxDrift = strtoll(argv[++i], NULL, 0);
+        }
+        else if (!script && argv[i][0] != '-')
+        {
+            script = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-o trace] [-c golden] [-t call_us] [-f dataflash] [-d drift_ms] script\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!script)
+    {
+        fprintf(stderr, "usage: %s [-o trace] [-c golden] [-t call_us] [-f dataflash] [-d drift_ms] script\n", argv[0]);
+        return 2;
+    }
+
+    loadScript(script);
+    loadDataFlash();
+    findPins();
+    trace   = open_memstream(&traceBuffer, &traceSize);
+    running = 1;
+
+    // The variables are initialised already, the host has no startup code to skip.
+    _sdcc_external_startup();
+    firmwareMain();
+    finish("return");
+    return 0;
+}
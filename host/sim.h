@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// Virtual MCU of the host build
+
+// Record a WS2812 frame at the current time.
+void simFrame(uint16_t ledCount, const uint8_t *ledData);
+
+// Advance the virtual clock by `cycles` of FREQ_SYS, running the interrupts that become due.
+void simDelay(uint64_t cycles);
+
+// DataFlash contents, loaded from and saved to the file given with -f.
+extern uint8_t simDataFlash[128];
+
+// Record a DataFlash write at the current time.
+void simWriteDataFlash(uint8_t address, const uint8_t *data, uint8_t length);
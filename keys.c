@@ -0,0 +1,114 @@
+#include "keys.h"
+
+// Debouncing
+// Every key has a 2-bit counter, bit 0 in keyCount0 and bit 1 in keyCount1, so the 5 keys count
+// together in a few logic operations. A counter runs while the key differs from keyState and
+// resets when it matches again. The key toggles after 4 scans in a row, 8ms.
+__data uint8_t keyState  = 0;  // Debounced keys, 1 = pressed
+__data uint8_t keyCount0 = 0;
+__data uint8_t keyCount1 = 0;
+
+__data uint8_t  keyConsumed = 0;  // Keys of a long press or a chord, their release is not sent
+__data uint16_t keyHeld     = 0;  // Scans since keyState changed
+
+// Event queue, written by scanKeys() and read by readKeyEvent().
+// A scan sends up to 5 presses or releases, a chord and a long press.
+#define KEY_EVENTS_PER_SCAN 7
+__xdata KeyEvent        keyEvents[KEY_EVENT_QUEUE_SIZE];
+__data volatile uint8_t keyEventHead = 0;
+__data volatile uint8_t keyEventTail = 0;
+
+void initKeys()
+{
+    // Configure the key pins in Quasi-Bidirectional mode, support input with internal pull-up.
+    // - Pn_MOD_OC = 1 (Open-Drain)
+    // - Pn_DIR_PU = 1 (Pull-Up)
+    P1_MOD_OC |= KEY_ALL;
+    P1_DIR_PU |= KEY_ALL;
+}
+
+// Runs in timer0_interrupt(), its parameters must not share memory with the main loop.
+#pragma save
+#pragma nooverlay
+static void pushEvent(uint8_t type, uint8_t keys, uint16_t time)
+{
+    __xdata KeyEvent *const event = &keyEvents[keyEventHead];
+
+    event->type  = type;
+    event->keys  = keys;
+    event->time  = time;
+    keyEventHead = (keyEventHead + 1) & (KEY_EVENT_QUEUE_SIZE - 1);
+}
+#pragma restore
+
+void scanKeys(uint16_t now)
+{
+    const uint8_t delta = (~P1 & KEY_ALL) ^ keyState;
+    const uint8_t room  = (keyEventTail - keyEventHead - 1) & (KEY_EVENT_QUEUE_SIZE - 1);
+
+    keyCount1 = (keyCount1 ^ keyCount0) & delta;
+    keyCount0 = ~keyCount0 & delta;
+
+    const uint8_t toggled = delta & ~(keyCount0 | keyCount1);
+
+    if (toggled)
+    {
+        // Nothing is dropped when the main loop falls behind, the change is taken on a later scan.
+        if (room < KEY_EVENTS_PER_SCAN)
+        {
+            return;
+        }
+
+        keyState ^= toggled;
+        keyHeld = 0;
+
+        for (uint8_t key = 1; key; key <<= 1)
+        {
+            if (toggled & key)
+            {
+                if (keyState & key)
+                {
+                    pushEvent(KEY_EVENT_PRESS, key, now);
+                }
+                else if (!(keyConsumed & key))
+                {
+                    pushEvent(KEY_EVENT_RELEASE, key, now);
+                }
+            }
+        }
+        keyConsumed &= keyState;
+
+        // More than 1 key held, and not already part of a chord.
+        const uint8_t loose = keyState & ~keyConsumed;
+        if ((toggled & keyState) && (loose & (loose - 1)))
+        {
+            pushEvent(KEY_EVENT_CHORD, loose, now);
+            keyConsumed = keyState;
+        }
+    }
+    else if (keyState & ~keyConsumed)
+    {
+        if (++keyHeld >= KEY_LONG_PRESS / KEY_SCAN_INTERVAL && room >= KEY_EVENTS_PER_SCAN)
+        {
+            pushEvent(KEY_EVENT_LONG, keyState, now);
+            keyConsumed = keyState;
+        }
+    }
+}
+
+// Take the oldest event, returns 0 if there is none.
+__bit readKeyEvent(__data KeyEvent *event)  // `__data` -> 8-bit pointer
+{
+    if (keyEventTail == keyEventHead)
+    {
+        return 0;
+    }
+
+    __xdata const KeyEvent *const next = &keyEvents[keyEventTail];
+
+    event->type  = next->type;
+    event->keys  = next->keys;
+    event->time  = next->time;
+    keyEventTail = (keyEventTail + 1) & (KEY_EVENT_QUEUE_SIZE - 1);
+    return 1;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <ch554.h>
+#include <stdint.h>
+
+// Key pins on P1, all pulled up, a pressed key reads 0.
+#define KEY_A   (1 << 1)  // P1.1
+#define KEY_B   (1 << 7)  // P1.7
+#define KEY_C   (1 << 6)  // P1.6
+#define KEY_D   (1 << 5)  // P1.5
+#define KEY_E   (1 << 4)  // P1.4
+#define KEY_ALL (KEY_A | KEY_B | KEY_C | KEY_D | KEY_E)
+
+#define KEY_SCAN_INTERVAL 2    // Scan every other timer0 tick, must be a power of 2
+#define KEY_LONG_PRESS    800  // ms
+
+// Event types
+#define KEY_EVENT_PRESS   0
+#define KEY_EVENT_RELEASE 1  // Not sent for the keys of a long press or a chord
+#define KEY_EVENT_LONG    2  // A key held alone for KEY_LONG_PRESS ms
+#define KEY_EVENT_CHORD   3  // A key pressed while another is held, `keys` holds both
+
+// Events waiting to be read, must be a power of 2.
+#define KEY_EVENT_QUEUE_SIZE 16
+
+typedef struct
+{
+    uint8_t  type;
+    uint8_t  keys;  // KEY_A to KEY_E
+    uint16_t time;  // systemTime of the scan
+} KeyEvent;
+
+void initKeys();
+void scanKeys(uint16_t now);  // Called by timer0_interrupt()
+__bit readKeyEvent(__data KeyEvent *event);
@@ -0,0 +1,267 @@
+#include "led.h"
+#include "bitbang.h"
+
+#ifndef LED_INDEXED
+
+// GRB layers, 3 bytes an LED in each, with offsets in 8 bits. Longer layouts take LED_INDEXED.
+#if LED_COUNT > 85
+#error "More than 85 LEDs don't fit in XRAM as GRB, build with LED_INDEXED"
+#endif
+
+// Layers, composed from the bottom up by renderFrame():
+// - background: every LED, drawn by setRGB() to fadeColor()
+// - overlay:    the trains, a colour in code memory per LED, 0 where it is transparent
+// - effects:    RGB on top of both, where its mask bit is set
+// The composed frame goes to the back buffer, then becomes the front one, sent by bigBangWS2812().
+//
+// XRAM: 81 background + 54 overlay + 85 effects + 162 frames + 270 fades = 652 bytes of the 1KB.
+// With uart.c 178, keys.c 64, scheduler.c 36, buzzer.c 8 and state.c 8, the build takes 946 bytes,
+// 1009 with the counters of PROFILE. Counted from the declarations, the link map has the last word:
+// the effects keep their state in fadeFraction and the saved state is packed in uartPayload.
+__xdata uint8_t               background[LED_COUNT * 3];  // GRB
+__code const uint8_t *__xdata overlay[LED_COUNT];
+__xdata uint8_t               effects[LED_COUNT * 3];  // GRB
+__xdata uint8_t               effectMask[(LED_COUNT + 7) / 8];
+__data LedIndex               effectCount = 0;  // LEDs set in effectMask
+
+__xdata uint8_t          frameBuffers[2][LED_COUNT * 3];
+__xdata uint8_t *__data  ledData       = frameBuffers[0];  // Front buffer
+__data LedIndex          ledDirtyCount = 0;  // Render and send LED 0 to ledDirtyCount - 1 next frame
+
+// Fades run in 8.8 fixed point, the integer part is the colour in background.
+// 10 bytes per LED: 3 fractions, 3 deltas and the steps left.
+__xdata uint8_t fadeFraction[LED_COUNT * 3];
+__xdata int16_t fadeDelta[LED_COUNT * 3];  // Added to the colour every step
+__xdata uint8_t fadeStepsLeft[LED_COUNT];  // 0 if the LED is not fading
+__data LedIndex fadeCount = 0;             // Number of LEDs fading
+
+// LED putRGB() sets next, see seekRGB().
+__xdata uint8_t *__data putLed;
+__data LedIndex         putIndex;
+
+// WS2812 LEDs keep their colour when the frame ends before reaching them,
+// so only the LEDs up to the last changed one are sent.
+static void markDirty(LedIndex index)
+{
+    if (index >= ledDirtyCount)
+    {
+        ledDirtyCount = index + 1;
+    }
+}
+
+static void stopFade(LedIndex index)
+{
+    if (fadeStepsLeft[index])
+    {
+        fadeStepsLeft[index] = 0;
+        fadeCount--;
+    }
+}
+
+void setRGB(LedIndex index, uint8_t r, uint8_t g, uint8_t b)
+{
+    __xdata uint8_t *const led = &background[index * 3];
+
+    stopFade(index);
+
+    if (led[0] == g && led[1] == r && led[2] == b)
+    {
+        return;
+    }
+
+    led[0] = g;  // WS2812 takes GRB
+    led[1] = r;
+    led[2] = b;
+    markDirty(index);
+}
+
+void setColor(LedIndex index, __code const uint8_t *color)
+{
+    setRGB(index, color[0], color[1], color[2]);
+}
+
+void seekRGB(LedIndex index)
+{
+    putIndex = index;
+    putLed   = &background[index * 3];
+}
+
+void putRGB(uint8_t r, uint8_t g, uint8_t b)
+{
+    stopFade(putIndex);
+
+    if (putLed[0] != g || putLed[1] != r || putLed[2] != b)
+    {
+        putLed[0] = g;
+        putLed[1] = r;
+        putLed[2] = b;
+        markDirty(putIndex);
+    }
+
+    putLed += 3;
+    putIndex++;
+}
+
+// Fade from the current colour to r, g, b in 1 << shift steps.
+// The delta of a component is (target - current) x 256 / (1 << shift), a shift left by 8 - shift.
+// Its 2^shift additions land exactly on the target, so the target is not stored.
+void fadeRGB(LedIndex index, uint8_t r, uint8_t g, uint8_t b, uint8_t shift)
+{
+    const uint8_t                 offset = index * 3;
+    __xdata const uint8_t *const  led    = &background[offset];
+    __xdata int16_t *const        delta  = &fadeDelta[offset];
+    __xdata uint8_t *const        frac   = &fadeFraction[offset];
+    const uint8_t                 scale  = 8 - shift;
+
+    delta[0] = (int16_t)(g - led[0]) << scale;
+    delta[1] = (int16_t)(r - led[1]) << scale;
+    delta[2] = (int16_t)(b - led[2]) << scale;
+    frac[0]  = 0;
+    frac[1]  = 0;
+    frac[2]  = 0;
+
+    if (!fadeStepsLeft[index])
+    {
+        fadeCount++;
+    }
+    fadeStepsLeft[index] = 1 << shift;
+}
+
+void fadeColor(LedIndex index, __code const uint8_t *color, uint8_t shift)
+{
+    fadeRGB(index, color[0], color[1], color[2], shift);
+}
+
+// Move every fading LED 1 step, runs every FADE_INTERVAL ms.
+void stepFades()
+{
+    LedIndex                left  = fadeCount;
+    __xdata uint8_t        *led   = background;
+    __xdata uint8_t        *frac  = fadeFraction;
+    __xdata const int16_t  *delta = fadeDelta;
+
+    for (LedIndex i = 0; left; i++, led += 3, frac += 3, delta += 3)
+    {
+        if (!fadeStepsLeft[i])
+        {
+            continue;
+        }
+
+        for (uint8_t c = 0; c < 3; c++)
+        {
+            const uint16_t value = (((uint16_t)led[c] << 8) | frac[c]) + delta[c];
+            led[c]               = value >> 8;
+            frac[c]              = value;
+        }
+
+        if (--fadeStepsLeft[i] == 0)
+        {
+            fadeCount--;
+        }
+        left--;
+        markDirty(i);
+    }
+}
+
+// Show `color` over the background, 0 shows the background again.
+void setOverlay(LedIndex index, __code const uint8_t *color)
+{
+    if (overlay[index] != color)
+    {
+        overlay[index] = color;
+        markDirty(index);
+    }
+}
+
+void clearOverlay()
+{
+    for (LedIndex i = 0; i < LED_COUNT; i++)
+    {
+        setOverlay(i, 0);
+    }
+}
+
+// Show r, g, b over the other layers until clearEffects().
+void setEffectRGB(LedIndex index, uint8_t r, uint8_t g, uint8_t b)
+{
+    __xdata uint8_t *const led  = &effects[index * 3];
+    const uint8_t          mask = 1 << (index & 0x07);
+
+    if (!(effectMask[index >> 3] & mask))
+    {
+        effectMask[index >> 3] |= mask;
+        effectCount++;
+    }
+
+    led[0] = g;
+    led[1] = r;
+    led[2] = b;
+    markDirty(index);
+}
+
+void clearEffects()
+{
+    if (!effectCount)
+    {
+        return;
+    }
+
+    for (uint8_t i = 0; i < sizeof(effectMask); i++)
+    {
+        effectMask[i] = 0;
+    }
+    effectCount   = 0;
+    ledDirtyCount = LED_COUNT;
+}
+
+// Compose LED 0 to ledDirtyCount - 1 into the back buffer, then swap it to the front, ledData.
+// Only needed when ledDirtyCount is not 0, a layer has changed.
+void renderFrame()
+{
+    __xdata uint8_t *const back = ledData == frameBuffers[0] ? frameBuffers[1] : frameBuffers[0];
+    __xdata uint8_t       *out  = back;
+    __xdata const uint8_t *bg   = background;
+    __xdata const uint8_t *fx   = effects;
+    uint8_t                mask = 0;
+
+    for (LedIndex i = 0; i < ledDirtyCount; i++, out += 3, bg += 3, fx += 3)
+    {
+        __code const uint8_t *const train = overlay[i];
+
+        if (!(i & 0x07))
+        {
+            mask = effectCount ? effectMask[i >> 3] : 0;
+        }
+
+        if (mask & 0x01)
+        {
+            out[0] = fx[0];
+            out[1] = fx[1];
+            out[2] = fx[2];
+        }
+        else if (train)
+        {
+            out[0] = train[1];  // Colours are RGB, frames GRB
+            out[1] = train[0];
+            out[2] = train[2];
+        }
+        else
+        {
+            out[0] = bg[0];
+            out[1] = bg[1];
+            out[2] = bg[2];
+        }
+        mask >>= 1;
+    }
+
+    ledData = back;  // A single pointer write, the frame changes as a whole.
+}
+
+// Send every LED again at the next brightness level.
+void cycleBrightness()
+{
+    ledBrightness = (ledBrightness + 1) & (BRIGHTNESS_LEVELS - 1);
+    ledDirtyCount = LED_COUNT;
+}
+
+#endif
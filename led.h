@@ -0,0 +1,52 @@
+#pragma once
+
+#include <ch554.h>
+#include <stdint.h>
+
+// LEDs on the strip, another layout builds with EXTRA_FLAGS=-DLED_COUNT=n.
+#ifndef LED_COUNT
+#define LED_COUNT 27
+#endif
+
+// LED index, 16 bits once a layout has more than 255 LEDs.
+#if LED_COUNT > 255
+typedef uint16_t LedIndex;
+#else
+typedef uint8_t LedIndex;
+#endif
+
+// Colour components are full range, bigBangWS2812() applies the brightness and gamma while sending.
+#define FULL 255
+#define HALF 160  // Half as bright as FULL after the gamma curve, see gamma.c
+
+// A fade moves 1 step every FADE_INTERVAL ms (50 Hz), and lasts 1 << shift steps, shift = 1 to 7.
+#define FADE_INTERVAL 20
+
+#ifdef LED_INDEXED
+// Indexed frames, see palette.c: 4 bits per LED into a palette of PALETTE_SIZE colours, at about
+// a quarter of the XRAM of the GRB frames in led.c. Fades are not available, they change at once.
+#define PALETTE_SIZE 16
+
+// Palette as sent, GRB after brightness and gamma, updated by renderFrame().
+extern __xdata uint8_t ledWire[PALETTE_SIZE * 3];
+#endif
+
+// Front frame buffer, GRB or palette indices, updated by renderFrame().
+extern __xdata uint8_t *__data ledData;
+extern __data LedIndex         ledDirtyCount;
+
+void setRGB(LedIndex index, uint8_t r, uint8_t g, uint8_t b);
+void setColor(LedIndex index, __code const uint8_t *color);
+// setRGB() of LED after LED from seekRGB(index) on, walking the layer like stepFades() instead of
+// working out every LED's address. For effects drawing the whole strip.
+void seekRGB(LedIndex index);
+void putRGB(uint8_t r, uint8_t g, uint8_t b);
+void fadeRGB(LedIndex index, uint8_t r, uint8_t g, uint8_t b, uint8_t shift);
+void fadeColor(LedIndex index, __code const uint8_t *color, uint8_t shift);
+void stepFades();
+void setOverlay(LedIndex index, __code const uint8_t *color);
+void clearOverlay();
+void setEffectRGB(LedIndex index, uint8_t r, uint8_t g, uint8_t b);
+void clearEffects();
+void renderFrame();
+void cycleBrightness();
@@ -3,22 +3,32 @@
 #include <ch554.h>
 #include <debug.h>
 
+#include "animation.h"
+#include "battery.h"
 #include "bitbang.h"
 #include "buzzer.h"
+#include "clock.h"
+#include "effects.h"
+#include "keys.h"
+#include "led.h"
+#include "profile.h"
+#include "scheduler.h"
+#include "state.h"
+#include "uart.h"
 
-// Input Pins
-#define KEY_A_PIN 1  // P1.1
-#define KEY_B_PIN 7  // P1.7
-#define KEY_C_PIN 6  // P1.6
-#define KEY_D_PIN 5  // P1.5
-#define KEY_E_PIN 4  // P1.4
+// Keys, see keys.h
+#define KEY_CHORD_BRIGHTNESS (KEY_A | KEY_B)  // Cycle the brightness
+#define KEY_LONG_POWER_OFF   KEY_E
 
-// All key pins are pulled up.
-// - A key pressed if input bit changes from 1 to 0.
-// - A key released if input bit changes from 0 to 1.
-#define KEY_PRESSED(KEY)  ((lastKeyState & (1 << (KEY))) && !(P1 & (1 << (KEY))))
-#define KEY_RELEASED(KEY) (!(lastKeyState & (1 << (KEY))) && (P1 & (1 << (KEY))))
-#define DEBOUNCE_INTERVAL 8  // 8 ms
+#define IDLE_TIMEOUT     300    // Power off after idle for 5 minutes
+#define SAVE_QUIET_TIME  60     // Save the state after a minute without keys or commands, see state.h
+
+// Battery, see battery.c
+#define BATTERY_INTERVAL 250    // Take a reading every 250ms
+#define BATTERY_LOW_TIME 10000  // Power off after 10 seconds of filtered readings under BATTERY_EMPTY_MV
+#define BATTERY_EMPTY_MV 3000
+#define BATTERY_FULL_MV  BATTERY_TOP_MV  // A charged battery reads no higher, see battery.c
+#define GAUGE_LENGTH     20  // The gauge takes LED 0 to 19
 
 // Output Pins
 #define LED_PIN      0  // P3.0 - WS2812 LED Strip
@@ -29,118 +39,255 @@ SBIT(LED, 0xB0, LED_PIN);            // P3.0
 SBIT(SHUTDOWN, 0xB0, SHUTDOWN_PIN);  // P3.3
 
 // Time in milliseconds
-//   2^32 / 1000 / 3600 / 24 = 49.71 days
-__data volatile uint32_t systemTime         = 0;
-__data uint32_t          lastUserActionTime = 0;
-// __data uint32_t previousTime   = 0;
+// - Wraps every 65.536 seconds, only the difference of 2 times is meaningful.
+// - Read it with getTime(), a plain 16-bit read can tear when timer0_interrupt() carries.
+__data volatile uint16_t systemTime   = 0;
+__data uint16_t          systemTimeUs = 0;  // µs past systemTime, below 1000, kept by timer0_interrupt()
+__data uint16_t          idleSeconds  = 0;  // Seconds since the last key change
+
+// Menu, key E goes through MENU_SUBWAY to MENU_BATTERY
+#define MENU_SUBWAY    0
+#define MENU_TIMETABLE 1  // Trains run on their own, a key takes its line over
+#define MENU_LIGHTS    2  // Blink LEDs
+#define MENU_SONGS     3  // Play songs
+#define MENU_BATTERY   4  // Battery gauge
+#define MENU_REMOTE    5  // Only set from the UART, only CMD_SET_FRAME draws
+__data uint8_t menuIndex = MENU_SUBWAY;
+
+// UART commands, see uart.h for the packets.
+#define CMD_SET_FRAME     0x01  // [first LED] [R G B] x n, over any menu until the menu changes
+#define CMD_SET_MODE      0x02  // [menu]
+#define CMD_RUN_SUBWAY    0x03  // [line] [forward]
+#define CMD_PLAY_MELODY   0x04  // [melody], an index of melodies[]
+#define CMD_READ_COUNTERS 0x05  // -> [time] [idle seconds] [battery mV] [frames] (16-bit, LSB first)
+                                //    [UART overflows] [UART bad packets]
+#define CMD_READ_PROFILE  0x06  // -> profile.h, only built with PROFILE
 
-// Menu
-// 0 - Subway
-// 1 - Blink LEDs
-__data uint8_t menuIndex = 0;
+// [first LED] of CMD_SET_FRAME takes 2 bytes, LSB first, once the strip is longer than 255 LEDs.
+#if LED_COUNT > 255
+#define FRAME_FIRST_SIZE 2
+#else
+#define FRAME_FIRST_SIZE 1
+#endif
+
+__data uint16_t frameCount = 0;  // Frames sent since reset
 
 // WS2812
-#define LED_COUNT  27
-#define BRIGHTNESS 5
-__xdata uint8_t        ledData[LED_COUNT * 3];  // In external data memory
-__bit                  ledDataChanged = 0;
-__data int8_t          lightMode      = 0;
-__xdata const uint8_t  RED[]          = {BRIGHTNESS, 0, 0};
-__xdata const uint8_t  ORANGE[]       = {BRIGHTNESS, BRIGHTNESS >> 1, 0};
-__xdata const uint8_t  YELLOW[]       = {BRIGHTNESS, BRIGHTNESS, 0};
-__xdata const uint8_t  GREEN[]        = {0, BRIGHTNESS, 0};
-__xdata const uint8_t  LIGHTBLUE[]    = {0, BRIGHTNESS >> 1, BRIGHTNESS};
-__xdata const uint8_t  BLUE[]         = {0, 0, BRIGHTNESS};
-__xdata const uint8_t  INDIGO[]       = {BRIGHTNESS >> 1, 0, BRIGHTNESS};
-__xdata const uint8_t  PURPLE[]       = {BRIGHTNESS, 0, BRIGHTNESS};
-__xdata const uint8_t  BLACK[]        = {0, 0, 0};
-__xdata const uint8_t  BRIGHT[]       = {255, 255, 255};
-__xdata const uint8_t *palette[]      = {RED, ORANGE, YELLOW, GREEN, LIGHTBLUE, BLUE, INDIGO, PURPLE};
+#define TRAIN_FADE 4  // A train leaving a stop fades in 16 steps, 320ms
+#define GATE_FADE  3  // Gates swap colours in 8 steps, 160ms
+#define BLINK_FADE 3  // Blink mode 2 fades to the next colour in 8 steps, 160ms
+__data uint8_t lastFrameTime = 0xFF;  // Low byte of systemTime when the last frame was sent, see main()
+__data int8_t  lightMode     = 0;
+
+// Light modes of MENU_LIGHTS, keys A to D step through them.
+#define LIGHT_MODES  (LIGHT_EFFECT + EFFECT_COUNT)
+#define LIGHT_SHOW   5  // Plays colorWipe[] straight from flash, see animation.h
+#define LIGHT_EFFECT 6  // Modes 6 and up play the effects of effects.h, from EFFECT_RAINBOW
+
+// Read-only tables live in code memory and are read with movc, `__xdata const` ones are copied
+// from flash into the 1KB XRAM by the startup code, `__data const` ones take up the internal RAM.
+__code const uint8_t RED[]       = {FULL, 0, 0};
+__code const uint8_t ORANGE[]    = {FULL, HALF, 0};
+__code const uint8_t YELLOW[]    = {FULL, FULL, 0};
+__code const uint8_t GREEN[]     = {0, FULL, 0};
+__code const uint8_t LIGHTBLUE[] = {0, HALF, FULL};
+__code const uint8_t BLUE[]      = {0, 0, FULL};
+__code const uint8_t INDIGO[]    = {HALF, 0, FULL};
+__code const uint8_t PURPLE[]    = {FULL, 0, FULL};
+__code const uint8_t BLACK[]     = {0, 0, 0};
+__code const uint8_t BRIGHT[]    = {255, 255, 255};
 
+__code const uint8_t *__code const palette[] = {RED, ORANGE, YELLOW, GREEN, LIGHTBLUE, BLUE, INDIGO, PURPLE};
+
+// Subway network, never changes.
+// - Every stop is an LED. An LED on several routes is a shared station, owned by one line in
+//   stopOwner[], and it takes its owner's colour once a train has left it, whatever line that was.
+// - A train shows on the overlay layer over its stop, the first line in routes[] wins when 2 trains
+//   meet. The station below keeps its colour.
+// Redrawing a stop only looks at the LINE_COUNT trains, never at the whole strip.
+// - The network takes LED 0 to SUBWAY_LEDS - 1, a longer strip leaves the LEDs past it dark.
+typedef struct
+{
+    __code const uint8_t *stops;
+    uint8_t               length;
+    __code const uint8_t *color;
+    __code const uint8_t *arrivalColor;
+    __code const uint8_t *gates;      // 2 LEDs swapped at every arrival, or 0
+    __code const uint8_t *timetable;  // Dwell and travel time to the next stop of every stop
+} Route;
+
+// State of a subway line.
 typedef struct
 {
-    const uint8_t                stops[20];
-    const uint8_t                length;
-    uint8_t                      at;
-    uint8_t                      running;       // __bit will be promoted to int here
-    __xdata const uint8_t *const color;         // `__data` -> 8-bit pointer
-    __xdata const uint8_t *const arrivalColor;  // `__data` -> 8-bit pointer
-} Subway;
+    uint8_t at;
+    uint8_t running;  // __bit will be promoted to int here
+} Line;
+
+#define LINE_COUNT  2
+#define NO_LINE     0xFF
+#define SUBWAY_LEDS 27  // Stops and gates of the tables below
+
+#if LED_COUNT < SUBWAY_LEDS
+#error "The subway network needs SUBWAY_LEDS LEDs"
+#endif
 
-__data Subway line[2] = {
+__code const uint8_t line0Stops[] = {
+    19, 0,  1,  2,  3,   //
+    4,  5,  6,  7,  8,   //
+    9,  10, 11, 12, 13,  //
+    14, 15, 16, 17, 18   //
+};
+
+__code const uint8_t line1Stops[] = {
+    11, 12, 13, 14, 15,  //
+    16, 17, 18, 19, 20,  //
+    21, 22, 23, 24       //
+};
+
+__code const uint8_t line0Gates[] = {25, 26};
+
+// Timetables, in TIMETABLE_UNIT, [dwell, travel] per stop
+#define TIMETABLE_UNIT 100  // ms
+
+__code const uint8_t line0Timetable[] = {
+    30, 20, 10, 15, 10, 15, 10, 15, 20, 20,  // Stop 19, 0 - 3
+    10, 15, 10, 15, 10, 15, 10, 15, 20, 20,  // Stop 4 - 8
+    10, 15, 10, 20, 10, 15, 10, 15, 10, 15,  // Stop 9 - 13, 11 on is shared with line 1
+    10, 15, 10, 15, 10, 15, 10, 15, 10, 20,  // Stop 14 - 18
+};
+
+__code const uint8_t line1Timetable[] = {
+    20, 20, 10, 20, 10, 20, 10, 20, 10, 20,  // Stop 11 - 15, shared with line 0
+    10, 20, 10, 20, 10, 20, 20, 15, 10, 15,  // Stop 16 - 20, 19 is the last shared one
+    10, 15, 10, 15, 10, 15, 30, 25,          // Stop 21 - 24
+};
+
+__code const Route routes[LINE_COUNT] = {
     {
-        {
-            19, 0,  1,  2,  3,   // .stops
-            4,  5,  6,  7,  8,   //
-            9,  10, 11, 12, 13,  //
-            14, 15, 16, 17, 18   //
-        },
-        20,     // .length
-        0,      // .at
-        1,      // .running
-        GREEN,  // .color
-        RED,    // .arrivalColor
+        line0Stops,          // .stops
+        sizeof(line0Stops),  // .length
+        GREEN,               // .color
+        RED,                 // .arrivalColor
+        line0Gates,          // .gates
+        line0Timetable,      // .timetable
     },
     {
-        {
-            11, 12, 13, 14, 15,  // .stops
-            16, 17, 18, 19, 20,  //
-            21, 22, 23, 24       //
-        },
-        14,         // .length
-        0,          // .at
-        1,          // .running
-        LIGHTBLUE,  // .color
-        INDIGO,     // .arrivalColor
+        line1Stops,          // .stops
+        sizeof(line1Stops),  // .length
+        LIGHTBLUE,           // .color
+        INDIGO,              // .arrivalColor
+        0,                   // .gates
+        line1Timetable,      // .timetable
     },
 };
 
-__data const uint8_t subwayGates[2] = {25, 26};
+// Line owning the stop on every LED, NO_LINE if the LED is not a stop.
+__code const uint8_t stopOwner[SUBWAY_LEDS] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // LED 0 - 9
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // LED 10 - 19, 11 - 19 shared with line 1
+    1, 1, 1, 1, 1,                 // LED 20 - 24
+    NO_LINE, NO_LINE,              // Gates of line 0
+};
+
+__data Line line[LINE_COUNT] = {
+    {0, 1},  // .at, .running
+    {0, 1},  // .at, .running
+};
+
+__data uint8_t leftStops[(SUBWAY_LEDS + 7) / 8];  // Bit set once a train has left the stop
+__bit          trainsDark = 1;                    // The running trains are off, see blinkSubwayLights()
+
+// Timetable, see runTimetable()
+#define LINE_HOLD_TIME   500    // ms before a train held at a stop checks the next one again
+#define LINE_MANUAL_TIME 30000  // ms a line stays with the keys after its last key
+__data uint16_t lineDue[LINE_COUNT];  // Time of the next move of every line
+
+// Generated by tools/rtttl.py
+// The Star Song:d=8,o=4,b=120:c,c,g,g,a,a,4g,f,f,e,e,d,d,4c
+__code const uint8_t theStarSong[] = {
+    NOTE_C | LEN_8, NOTE_C | LEN_8, NOTE_G | LEN_8, NOTE_G | LEN_8, NOTE_A | LEN_8, NOTE_A | LEN_8,
+    NOTE_G | LEN_4, NOTE_F | LEN_8, NOTE_F | LEN_8, NOTE_E | LEN_8, NOTE_E | LEN_8, NOTE_D | LEN_8,
+    NOTE_D | LEN_8, NOTE_C | LEN_4, MELODY_END
+};
+
+// Startup Sound:d=8,o=4,b=120:e5,b,a.,e5,4b
+__code const uint8_t startupSound[] = {
+    OCTAVE(5), NOTE_E | LEN_8, OCTAVE(4), NOTE_B | LEN_8, NOTE_A | LEN_8 | LEN_DOT, OCTAVE(5),
+    NOTE_E | LEN_8, OCTAVE(4), NOTE_B | LEN_4, MELODY_END
+};
+
+// Shutdown Sound:d=16,o=4,b=100:a5,e5,a,8b
+__code const uint8_t shutdownSound[] = {
+    TEMPO(100), OCTAVE(5), NOTE_A | LEN_16, NOTE_E | LEN_16, OCTAVE(4), NOTE_A | LEN_16,
+    NOTE_B | LEN_8, MELODY_END
+};
 
-__xdata const uint8_t theStarSong[] = {
-    14,                                               // length
-    C4, 2, C4, 2, G4, 2, G4, 2, A4, 2, A4, 2, G4, 4,  // 1 1 | 5 5 | 6 6 | 5 -
-    F4, 2, F4, 2, E4, 2, E4, 2, D4, 2, D4, 2, C4, 4   // 4 4 | 3 3 | 2 2 | 1 -
+// Warning Sound:d=8,o=4,b=120:c,c,c
+__code const uint8_t warningSound[] = {
+    NOTE_C | LEN_8, NOTE_C | LEN_8, NOTE_C | LEN_8, MELODY_END
 };
-__xdata const uint8_t startupSound[]  = {5, E5, 2, B4, 2, A4, 3, E5, 2, B4, 4};
-__xdata const uint8_t shutdownSound[] = {4, A5, 1, E5, 1, A4, 1, B4, 2};
-__xdata const uint8_t warningSound[]  = {3, C4, 2, C4, 2, C4, 2};
 
-void setColor(uint8_t index, __xdata const uint8_t *color)  // `__data` -> 8-bit pointer
+__code const uint8_t *__code const melodies[] = {theStarSong, startupSound, shutdownSound, warningSound};
+
+// Show the train at a stop on the overlay layer, the first line in routes[] if there are 2.
+void drawTrain(uint8_t stop)
+{
+    __code const uint8_t *color = 0;
+
+    for (uint8_t i = 0; i < LINE_COUNT; i++)
+    {
+        if (routes[i].stops[line[i].at] == stop)
+        {
+            color = line[i].running && trainsDark ? BLACK : routes[i].arrivalColor;
+            break;
+        }
+    }
+
+    setOverlay(stop, color);
+}
+
+// Fade the station under a stop to its owner's colour once a train has left it.
+void drawStation(uint8_t stop)
 {
-    index *= 3;
-    ledData[index]   = color[1];
-    ledData[++index] = color[0];
-    ledData[++index] = color[2];
+    if (leftStops[stop >> 3] & (1 << (stop & 0x07)))
+    {
+        fadeColor(stop, routes[stopOwner[stop]].color, TRAIN_FADE);
+    }
 }
 
 void initSubway()
 {
-    for (uint8_t i = 0; i < LED_COUNT; i++)
+    for (LedIndex i = 0; i < LED_COUNT; i++)
     {
         setColor(i, YELLOW);
     }
-
-    ledDataChanged = 1;
+    for (uint8_t i = 0; i < sizeof(leftStops); i++)
+    {
+        leftStops[i] = 0;
+    }
+    for (uint8_t i = 0; i < LINE_COUNT; i++)
+    {
+        drawTrain(routes[i].stops[line[i].at]);
+    }
 }
 
 void runSubway(uint8_t i, __bit forward)
 {
-    __data Subway *const l           = &line[i];  // `__data` -> 8-bit pointer
-    __data const uint8_t currentStop = l->stops[l->at];
+    __code const Route *const r           = &routes[i];
+    __data Line *const        l           = &line[i];  // `__data` -> 8-bit pointer
+    const uint8_t             currentStop = r->stops[l->at];
 
     l->running = !l->running;
 
     // 1. Arrived -> Running (running == true)
-    //    - Set current stop to `color`
     //    - Move to next stop
+    //    - The station left takes the train's colour and fades to its owner's
     // 2. Running -> Arrived (running == false)
-    //    - Set current stop to `arrivalColor`
+    //    - Show the train steady in `arrivalColor`
     if (l->running)
     {
-        const uint8_t length = l->length;
+        const uint8_t length = r->length;
 
-        setColor(currentStop, l->color);
         if (forward)
         {
             if (++l->at == length)
@@ -156,47 +303,110 @@ void runSubway(uint8_t i, __bit forward)
             }
             l->at--;
         }
+
+        leftStops[currentStop >> 3] |= 1 << (currentStop & 0x07);
+        setColor(currentStop, r->arrivalColor);
+        drawStation(currentStop);
+        drawTrain(currentStop);
+        drawTrain(r->stops[l->at]);
     }
     else
     {
-        setColor(currentStop, l->arrivalColor);
+        drawTrain(currentStop);
 
-        if (i == 0)
+        __code const uint8_t *const gates = r->gates;
+        if (gates)
         {
             uint8_t at = l->at;
-            setColor(subwayGates[at & 0x01], YELLOW);
-            setColor(subwayGates[++at & 0x01], BLUE);
+            fadeColor(gates[at & 0x01], YELLOW, GATE_FADE);
+            fadeColor(gates[++at & 0x01], BLUE, GATE_FADE);
         }
     }
-
-    ledDataChanged = 1;
 }
 
 void blinkSubwayLights()
 {
-    __xdata static uint32_t lastBlinkTime = 0;
-    static __bit            on            = 0;
+    // Off for 300ms, on for 700ms.
+    trainsDark = !trainsDark;
 
-    if (systemTime - lastBlinkTime >= (on ? 700 : 300))
+    for (uint8_t i = 0; i < LINE_COUNT; ++i)
     {
-        for (uint8_t i = 0; i < 2; ++i)
+        if (line[i].running)
         {
-            __data Subway *l = &line[i];  // `__data` -> 8-bit pointer
-            if (l->running)
-            {
-                setColor(l->stops[l->at], on ? BLACK : l->arrivalColor);
-            }
+            drawTrain(routes[i].stops[line[i].at]);
         }
+    }
 
-        on             = !on;
-        ledDataChanged = 1;
-        lastBlinkTime  = systemTime;
+    scheduleTask(TASK_BLINK, blinkSubwayLights, trainsDark ? 300 : 700, 0);
+}
+
+// State kept over power-offs, see state.h
+//   [menu] [light mode] [brightness] [stop of line 0] [stop of line 1] [running lines, bit n = line n]
+// It is packed in uartPayload, free outside of processCommands(), which never saves or restores.
+#if STATE_SIZE > UART_MAX_PAYLOAD
+#error "The state does not fit in uartPayload"
+#endif
+
+void saveState()
+{
+    __xdata uint8_t *const state = uartPayload;
+
+    state[0] = menuIndex;
+    state[1] = lightMode;
+    state[2] = ledBrightness;
+    state[5] = 0;
+    for (uint8_t i = 0; i < LINE_COUNT; i++)
+    {
+        state[3 + i] = line[i].at;
+        if (line[i].running)
+        {
+            state[5] |= 1 << i;
+        }
+    }
+
+    writeState(state);
+}
+
+// Values out of range are left at their defaults. The songs and remote menus are not restored, the
+// subway takes their place.
+void restoreState()
+{
+    __xdata uint8_t *const state = uartPayload;
+
+    if (!readState(state))
+    {
+        return;
+    }
+
+    if (state[0] <= MENU_BATTERY && state[0] != MENU_SONGS)
+    {
+        menuIndex = state[0];
+    }
+    if (state[1] < LIGHT_MODES)
+    {
+        lightMode = state[1];
+    }
+    ledBrightness = state[2] & (BRIGHTNESS_LEVELS - 1);
+    for (uint8_t i = 0; i < LINE_COUNT; i++)
+    {
+        if (state[3 + i] < routes[i].length)
+        {
+            line[i].at      = state[3 + i];
+            line[i].running = (state[5] >> i) & 0x01;
+        }
     }
 }
 
 void shutdown()
 {
-    playBuzzer(shutdownSound);
+    saveState();
+    startMelody(shutdownSound);
+#ifdef PROFILE
+    sendProfile(CMD_READ_PROFILE);  // Sent while the melody plays
+#endif
+    while (isBuzzerBusy())  // Keep the power on until the melody ends.
+    {
+    }
     SHUTDOWN = 1;
 }
 
@@ -204,198 +414,589 @@ void timer0_interrupt(void) __interrupt(INT_NO_TMR0)
 {
     // In Mode 1, timer0/1 interrupt is triggered when TH0/1 & TL0/1 changes from 0xFFFF to 0x0000.
     // After reset (bT0_CLK = 0), the timer0's internal clock frequency is MCU_Frequency/12.
-    // Calculate TH & TL,
-    //   (0xFFFF + 1 - 0xTHTL) x (1 / (MCU_Frequency / 12))) = 0.001s
-    //   -> 0xTHTL = 65536 - 0.001 x (MCU_Frequency / 12)
-    // MCU Frequency    TH    TL     Decimal
-    //        32 MHz  0xF5  0x95  62,869.333
-    //        24 MHz  0xF8  0x30  63,536
-    //        16 MHz  0xFA  0xCB  64,202.667
-    //        12 MHz  0xFC  0x18  64,536
-    //         6 MHz  0xFE  0x0C  65,036
-    //         3 MHz  0xFF  0x06  65,286
-    //       750 KHz  0xFF  0xC2  65,473.5
-    //      187.5KHz  0xFF  0xF0  65,520.375
-
-    // Reset TH0 & TL0 for the next interrupt
-    TH0 = 0xFC;
-    TL0 = 0x18;
-
-    systemTime++;
+    // Only TH0 is set, TIMER0_STEPS steps of 256 counts before the overflow, TIMER0_PERIOD_US.
+    // MCU Frequency   Steps   Period
+    //        32 MHz      10    960µs
+    //        24 MHz       8   1024µs
+    //        16 MHz       5    960µs
+    //        12 MHz       4   1024µs
+    //         6 MHz       2   1024µs
+    //         3 MHz       1   1024µs
+    //
+    // TL0 is never written, it counts on from the overflow while the interrupt waits, so no count
+    // is dropped. TH0 keeps the steps made since the overflow, and when interrupts stay off over
+    // more periods, it counts them: up to 255 steps.
+    const uint8_t length  = clockSlow ? TIMER0_STEPS_SLOW : TIMER0_STEPS;  // Of the periods counted
+    uint8_t       high    = TH0;
+    uint8_t       low     = TL0;
+    uint8_t       periods = 1;
+    if (TH0 != high)  // TL0 carried between the reads
+    {
+        high = TH0;
+        low  = TL0;
+    }
+    while (high >= length)
+    {
+        high -= length;
+        periods++;
+    }
+
+    // Switch the clock if the main loop asked for it, the next period runs at it. See clock.h.
+    // The steps made since the overflow ran at the old clock, they are only kept without a switch.
+    // The counts in TL0 are, and run at the other clock for the time of an interrupt entry on the
+    // way down and on the way up, which cancel out.
+    updateClock();
+    const uint8_t next = clockSlow ? TIMER0_STEPS_SLOW : TIMER0_STEPS;
+    if (next != length)
+    {
+        high = 0;
+    }
+
+    TH0 = high - next;
+    if (TL0 < low && TH0 == (uint8_t)(high - next))  // TL0 carried before the write, into old TH0
+    {
+        if (++high == next)
+        {
+            high = 0;
+            periods++;
+        }
+        TH0 = high - next;
+    }
+
+    // Whole ms of the periods go to systemTime.
+    const uint8_t before = systemTime;
+    do
+    {
+        systemTimeUs += TIMER0_PERIOD_US;
+        while (systemTimeUs >= 1000)
+        {
+            systemTimeUs -= 1000;
+            systemTime++;
+        }
+    } while (--periods);
+
+    // Scan when systemTime reaches a multiple of KEY_SCAN_INTERVAL, it can step by more than 1.
+    if (((uint8_t)systemTime ^ before) & ~(KEY_SCAN_INTERVAL - 1))
+    {
+        scanKeys(systemTime);
+    }
+}
+
+uint16_t getTime()
+{
+    ET0 = 0;  // Hold timer0_interrupt() off while the 2 bytes are read.
+    const uint16_t time = systemTime;
+    ET0 = 1;
+    return time;
+}
+
+// Wait for the next tick of timer0_interrupt() when there is nothing to do before it.
+// The CPU spins here, drawing the same current as when it works: only the slow clock of clock.h
+// lowers it. The CH552 has no idle mode, and PD stops timer0 with the clock, so the battery check
+// and the idle power-off would stop too, and only keys D and E (P1.5, P1.4) could wake it.
+void waitForTick(uint8_t tick)
+{
+    while ((uint8_t)getTime() == tick)
+    {
+    }
+}
+
+// A train of another line is at `stop`, or running to it.
+__bit isStopTaken(uint8_t i, uint8_t stop)
+{
+    for (uint8_t j = 0; j < LINE_COUNT; j++)
+    {
+        if (j != i && routes[j].stops[line[j].at] == stop)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Move line i forward on its timetable, returns the ms to its next move.
+// - A running train arrives and dwells at its stop.
+// - An arrived train leaves for the next stop, unless another train is there, then it holds.
+uint16_t moveLine(uint8_t i)
+{
+    __code const Route *const r = &routes[i];
+    __data Line *const        l = &line[i];  // `__data` -> 8-bit pointer
+
+    if (l->running)
+    {
+        runSubway(i, 1);
+        return r->timetable[l->at * 2] * TIMETABLE_UNIT;
+    }
+
+    const uint8_t at = l->at;
+    if (isStopTaken(i, r->stops[at + 1 == r->length ? 0 : at + 1]))
+    {
+        return LINE_HOLD_TIME;
+    }
+
+    runSubway(i, 1);
+    return r->timetable[at * 2 + 1] * TIMETABLE_UNIT;
+}
+
+// Move the lines due, then sleep until the next move of any line. Runs in MENU_TIMETABLE.
+void runTimetable()
+{
+    const uint16_t now  = getTime();
+    uint16_t       next = now + 0x7FFF;
+
+    for (uint8_t i = 0; i < LINE_COUNT; i++)
+    {
+        if ((int16_t)(lineDue[i] - now) <= 0)
+        {
+            lineDue[i] = now + moveLine(i);
+        }
+        if ((int16_t)(lineDue[i] - next) < 0)
+        {
+            next = lineDue[i];
+        }
+    }
+
+    scheduleTask(TASK_TIMETABLE, runTimetable, next - now, 0);
+}
+
+void startTimetable()
+{
+    const uint16_t now = getTime();
+
+    // Line 0 first, each line 1s after the previous one.
+    for (uint8_t i = 0; i < LINE_COUNT; i++)
+    {
+        lineDue[i] = now + 1000 * (i + 1);
+    }
+    scheduleTask(TASK_TIMETABLE, runTimetable, 1000, 0);
+}
+
+// A key moves line i, the timetable leaves it alone for LINE_MANUAL_TIME.
+void driveLine(uint8_t i, __bit forward)
+{
+    lineDue[i] = getTime() + LINE_MANUAL_TIME;
+    runSubway(i, forward);
+}
+
+// Light mode LIGHT_SHOW, converted by tools/animation.py
+// colorWipe.csv, 36 frames of 30ms steps
+__code const uint8_t colorWipe[] = {  // 222 bytes
+    30,
+    2, ANIM_FILL(3), 0x00, 0xFF, 0x00, ANIM_FILL(24), 0x00, 0x00, 0xFF, ANIM_FRAME_END,
+    2, ANIM_FILL(6), 0x00, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(9), 0x00, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(12), 0x00, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(15), 0x00, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(18), 0x00, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(21), 0x00, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(24), 0x00, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(27), 0x00, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(3), 0xFF, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(6), 0xFF, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(9), 0xFF, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(12), 0xFF, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(15), 0xFF, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(18), 0xFF, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(21), 0xFF, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(24), 0xFF, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(27), 0xFF, 0xFF, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(3), 0xFF, 0x00, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(6), 0xFF, 0x00, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(9), 0xFF, 0x00, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(12), 0xFF, 0x00, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(15), 0xFF, 0x00, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(18), 0xFF, 0x00, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(21), 0xFF, 0x00, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(24), 0xFF, 0x00, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(27), 0xFF, 0x00, 0x00, ANIM_FRAME_END,
+    2, ANIM_FILL(3), 0x00, 0x00, 0xFF, ANIM_FRAME_END,
+    2, ANIM_FILL(6), 0x00, 0x00, 0xFF, ANIM_FRAME_END,
+    2, ANIM_FILL(9), 0x00, 0x00, 0xFF, ANIM_FRAME_END,
+    2, ANIM_FILL(12), 0x00, 0x00, 0xFF, ANIM_FRAME_END,
+    2, ANIM_FILL(15), 0x00, 0x00, 0xFF, ANIM_FRAME_END,
+    2, ANIM_FILL(18), 0x00, 0x00, 0xFF, ANIM_FRAME_END,
+    2, ANIM_FILL(21), 0x00, 0x00, 0xFF, ANIM_FRAME_END,
+    2, ANIM_FILL(24), 0x00, 0x00, 0xFF, ANIM_FRAME_END,
+    2, ANIM_FILL(27), 0x00, 0x00, 0xFF, ANIM_FRAME_END,
+    ANIM_END,
+};
+
+void blinkLights()
+{
+    static uint8_t blinkCounter = 0;
+
+    // Runs every 300ms
+    switch (lightMode)
+    {
+        case 0:
+            for (LedIndex i = 0; i < LED_COUNT; i++)
+            {
+                setColor(i, ((i + blinkCounter) & 0x01) ? YELLOW : LIGHTBLUE);
+            }
+            break;
+        case 1:
+            for (LedIndex i = 0; i < LED_COUNT; i++)
+            {
+                setColor(i, palette[(i + blinkCounter) & 0x07]);
+            }
+            break;
+        case 2:
+            for (LedIndex i = 0; i < LED_COUNT; i++)
+            {
+                fadeColor(i, palette[blinkCounter & 0x07], BLINK_FADE);
+            }
+            break;
+        case 3:
+            for (LedIndex i = 0; i < LED_COUNT; i++)
+            {
+                if (((i + blinkCounter) & 0x07) < 2)
+                {
+                    setColor(i, palette[blinkCounter & 0x07]);
+                }
+            }
+            break;
+        case 4:
+            // A random colour, 3 bits a component, for every fourth LED.
+            for (LedIndex i = blinkCounter & 0x03; i < LED_COUNT; i += 4)
+            {
+                setRGB(i, random8() & 0xE0, random8() & 0xE0, random8() & 0xE0);
+            }
+            break;
+    }
+
+    ++blinkCounter;
+}
+
+// Draw lightMode in MENU_LIGHTS: blinkLights() every 300ms, or the effect every EFFECT_INTERVAL.
+void scheduleLightMode()
+{
+    if (lightMode >= LIGHT_EFFECT)
+    {
+        startEffect(lightMode - LIGHT_EFFECT);
+        scheduleTask(TASK_BLINK, stepEffect, 0, EFFECT_INTERVAL);
+    }
+    else
+    {
+        scheduleTask(TASK_BLINK, blinkLights, 0, 300);
+    }
 }
 
 void setLightMode(__bit inc)
 {
+    const __bit wasEffect = lightMode >= LIGHT_EFFECT;
+
     lightMode += inc ? 1 : -1;
 
     if (lightMode == -1)
     {
-        lightMode = 4;
+        lightMode = LIGHT_MODES - 1;
     }
-    else if (lightMode == 5)
+    else if (lightMode == LIGHT_MODES)
     {
         lightMode = 0;
     }
+
+    if (wasEffect || lightMode >= LIGHT_EFFECT)
+    {
+        scheduleLightMode();
+    }
+
+    if (lightMode == LIGHT_SHOW)
+    {
+        startAnimation(colorWipe);
+    }
+    else
+    {
+        stopAnimation();
+    }
 }
 
-void blinkLights()
+
+// Battery gauge on LED 0 to GAUGE_LENGTH - 1, runs every second in menu 3.
+void showBatteryGauge()
 {
-    __xdata static uint32_t lastBlinkTime = 0;
-    static uint8_t          blinkCounter  = 0;
+    const uint16_t mv  = batteryMillivolts();
+    uint8_t        lit = 0;
+
+    if (mv >= BATTERY_FULL_MV)
+    {
+        lit = GAUGE_LENGTH;
+    }
+    else if (mv > BATTERY_EMPTY_MV)
+    {
+        lit = 1 + (uint32_t)(mv - BATTERY_EMPTY_MV) * (GAUGE_LENGTH - 1) / (BATTERY_FULL_MV - BATTERY_EMPTY_MV);
+    }
 
-    // Blink every 500ms
-    if (systemTime - lastBlinkTime >= 300)
+    __code const uint8_t *const color = lit < GAUGE_LENGTH / 4 ? RED : lit < GAUGE_LENGTH / 2 ? YELLOW : GREEN;
+    for (LedIndex i = 0; i < LED_COUNT; i++)
+    {
+        setColor(i, i < lit ? color : BLACK);
+    }
+}
+
+void setMenu(uint8_t index)
+{
+    if (menuIndex == MENU_SONGS)
     {
-        switch (lightMode)
+        stopMelody();
+    }
+    cancelTask(TASK_TIMETABLE);
+    stopAnimation();
+    clearOverlay();
+    clearEffects();
+    menuIndex = index;
+
+    switch (index)
+    {
+        case MENU_SUBWAY:  // Reset subway lights
+            initSubway();
+            scheduleTask(TASK_BLINK, blinkSubwayLights, 300, 0);
+            break;
+        case MENU_TIMETABLE:
+            initSubway();
+            scheduleTask(TASK_BLINK, blinkSubwayLights, 300, 0);
+            startTimetable();
+            break;
+        case MENU_LIGHTS:
+            scheduleLightMode();
+            if (lightMode == LIGHT_SHOW)
+            {
+                startAnimation(colorWipe);
+            }
+            break;
+        case MENU_SONGS:
+            cancelTask(TASK_BLINK);
+            startMelody(theStarSong);
+            break;
+        case MENU_BATTERY:
+            scheduleTask(TASK_BLINK, showBatteryGauge, 0, 1000);
+            break;
+        case MENU_REMOTE:
+            cancelTask(TASK_BLINK);
+            break;
+    }
+}
+
+// A key released, without being part of a long press or a chord.
+void processKey(uint8_t key)
+{
+    if (key == KEY_A)
+    {
+        switch (menuIndex)
         {
-            case 0:
-                for (uint8_t i = 0; i < LED_COUNT; i++)
-                {
-                    setColor(i, ((i + blinkCounter) & 0x01) ? YELLOW : LIGHTBLUE);
-                }
+            case MENU_SUBWAY:
+            case MENU_TIMETABLE:
+                driveLine(0, 0);
                 break;
-            case 1:
-                for (uint8_t i = 0; i < 20; i++)
-                {
-                    setColor(i, palette[(i + blinkCounter) & 0x07]);
-                }
-                for (uint8_t i = 20; i < LED_COUNT; i++)
-                {
-                    setColor(i, palette[(i + blinkCounter) & 0x07]);
-                }
+            case MENU_LIGHTS:
+                setLightMode(1);
                 break;
-            case 2:
-                for (uint8_t i = 0; i < LED_COUNT; i++)
-                {
-                    setColor(i, palette[blinkCounter & 0x07]);
-                }
+        }
+    }
+    else if (key == KEY_B)
+    {
+        switch (menuIndex)
+        {
+            case MENU_SUBWAY:
+            case MENU_TIMETABLE:
+                driveLine(0, 1);
                 break;
-            case 3:
-                for (uint8_t i = 0; i < 20; i++)
-                {
-                    if (((i + blinkCounter) & 0x07) < 2)
-                    {
-                        setColor(i, palette[blinkCounter & 0x07]);
-                    }
-                }
-                for (uint8_t i = 20; i < LED_COUNT; i++)
-                {
-                    if (((i + blinkCounter) & 0x07) < 2)
-                    {
-                        setColor(i, palette[blinkCounter & 0x07]);
-                    }
-                }
+            case MENU_LIGHTS:
+                setLightMode(0);
                 break;
-            case 4:
-            {
-                uint16_t        rand = (uint16_t)systemTime;
-                __xdata uint8_t numbers[9];
-                for (uint8_t i = 0; i < 9; i++)
-                {
-                    numbers[i] = (rand >> i) & 0x07;
-                }
-                uint8_t next = 0;
-                for (uint8_t i = blinkCounter & 0x03; i < LED_COUNT; i += 4)
-                {
-                    setColor(i, &numbers[next++]);
-                }
+        }
+    }
+    else if (key == KEY_C)
+    {
+        switch (menuIndex)
+        {
+            case MENU_SUBWAY:
+            case MENU_TIMETABLE:
+                driveLine(1, 0);
+                break;
+            case MENU_LIGHTS:
+                setLightMode(1);
+                break;
+        }
+    }
+    else if (key == KEY_D)
+    {
+        switch (menuIndex)
+        {
+            case MENU_SUBWAY:
+            case MENU_TIMETABLE:
+                driveLine(1, 1);
+                break;
+            case MENU_LIGHTS:
+                setLightMode(0);
                 break;
-            }
         }
-
-        ++blinkCounter;
-        ledDataChanged = 1;
-        lastBlinkTime  = systemTime;
+    }
+    else if (key == KEY_E)
+    {
+        setMenu(menuIndex >= MENU_BATTERY ? MENU_SUBWAY : menuIndex + 1);
     }
 }
 
+// Act on the key events queued by scanKeys().
 void processEvents()
 {
-    __xdata static uint32_t lastDebounceTime = 0;
-    static uint8_t          lastKeyState     = 0xFF;  // All key pins are pulled up.
+    __data KeyEvent event;
 
-    if (systemTime - lastDebounceTime >= DEBOUNCE_INTERVAL)
+    while (readKeyEvent(&event))
     {
-        if (KEY_RELEASED(KEY_A_PIN))
+        idleSeconds = 0;
+        PROFILE_KEY(event.time);
+
+        if (event.type == KEY_EVENT_CHORD && event.keys == KEY_CHORD_BRIGHTNESS)
         {
-            switch (menuIndex)
-            {
-                case 0:
-                    runSubway(0, 0);
-                    break;
-                case 1:
-                    setLightMode(1);
-                    break;
-            }
+            cycleBrightness();
         }
-        if (KEY_RELEASED(KEY_B_PIN))
+        else if (event.type == KEY_EVENT_LONG && event.keys == KEY_LONG_POWER_OFF)
         {
-            switch (menuIndex)
-            {
-                case 0:
-                    runSubway(0, 1);
-                    break;
-                case 1:
-                    setLightMode(0);
-                    break;
-            }
+            shutdown();
         }
-        if (KEY_RELEASED(KEY_C_PIN))
+        else if (event.type == KEY_EVENT_RELEASE)
         {
-            switch (menuIndex)
-            {
-                case 0:
-                    runSubway(1, 0);
-                    break;
-                case 1:
-                    setLightMode(1);
-                    break;
-            }
+            processKey(event.keys);
         }
-        if (KEY_RELEASED(KEY_D_PIN))
+    }
+}
+
+
+// Act on the UART packets, every command is answered with a status or its data.
+void processCommands(uint16_t now)
+{
+    while (readUartPacket(now))
+    {
+        const uint8_t length = uartLength;
+        uint8_t       status = UART_OK;
+
+        idleSeconds = 0;
+
+        switch (uartCommand)
         {
-            switch (menuIndex)
+            case CMD_SET_FRAME:
             {
-                case 0:
-                    runSubway(1, 1);
+                if (length < FRAME_FIRST_SIZE || (length - FRAME_FIRST_SIZE) % 3)
+                {
+                    status = UART_BAD_LENGTH;
                     break;
-                case 1:
-                    setLightMode(0);
+                }
+
+#if LED_COUNT > 255
+                const LedIndex first = uartPayload[0] | uartPayload[1] << 8;
+#else
+                const LedIndex first = uartPayload[0];
+#endif
+                const uint8_t  count = (length - FRAME_FIRST_SIZE) / 3;
+
+                if (first >= LED_COUNT || count > LED_COUNT - first)
+                {
+                    status = UART_BAD_LENGTH;
                     break;
+                }
+
+                __xdata const uint8_t *rgb = &uartPayload[FRAME_FIRST_SIZE];
+                for (LedIndex i = first; i < first + count; i++, rgb += 3)
+                {
+                    setEffectRGB(i, rgb[0], rgb[1], rgb[2]);
+                }
+                break;
             }
-        }
-        if (KEY_RELEASED(KEY_E_PIN))
-        {
-            // Reset subway lights
-            switch (++menuIndex)
+            case CMD_SET_MODE:
+                if (length != 1)
+                {
+                    status = UART_BAD_LENGTH;
+                }
+                else if (uartPayload[0] > MENU_REMOTE)
+                {
+                    status = UART_BAD_VALUE;
+                }
+                else
+                {
+                    setMenu(uartPayload[0]);
+                }
+                break;
+            case CMD_RUN_SUBWAY:
+                if (length != 2)
+                {
+                    status = UART_BAD_LENGTH;
+                }
+                else if (uartPayload[0] >= LINE_COUNT)
+                {
+                    status = UART_BAD_VALUE;
+                }
+                else
+                {
+                    runSubway(uartPayload[0], uartPayload[1]);
+                }
+                break;
+            case CMD_PLAY_MELODY:
+                if (length != 1)
+                {
+                    status = UART_BAD_LENGTH;
+                }
+                else if (uartPayload[0] >= sizeof(melodies) / sizeof(melodies[0]))
+                {
+                    status = UART_BAD_VALUE;
+                }
+                else
+                {
+                    startMelody(melodies[uartPayload[0]]);
+                }
+                break;
+            case CMD_READ_COUNTERS:
             {
-                case 3:  // Go back to 0;
-                    menuIndex = 0;
-                case 0:  // Subway
-                    initSubway();
-                    break;
-                // case 1: // Lights
-                case 2:  // Play songs
-                    playBuzzer(theStarSong);
-                    break;
-            }
-        }
+                const uint16_t mv = batteryMillivolts();
 
-        if (lastKeyState != P1)
-        {
-            lastKeyState       = P1;
-            lastUserActionTime = systemTime;
+                uartPayload[0] = now;
+                uartPayload[1] = now >> 8;
+                uartPayload[2] = idleSeconds;
+                uartPayload[3] = idleSeconds >> 8;
+                uartPayload[4] = mv;
+                uartPayload[5] = mv >> 8;
+                uartPayload[6] = frameCount;
+                uartPayload[7] = frameCount >> 8;
+                uartPayload[8] = uartOverflows;
+                uartPayload[9] = uartBadPackets;
+                sendUartPacket(CMD_READ_COUNTERS, 10, uartPayload);
+                continue;
+            }
+#ifdef PROFILE
+            case CMD_READ_PROFILE:
+                if (length != 0)
+                {
+                    status = UART_BAD_LENGTH;
+                    break;
+                }
+                sendProfile(CMD_READ_PROFILE);
+                continue;
+#endif
+            default:
+                status = UART_BAD_COMMAND;
+                break;
         }
 
-        lastDebounceTime = systemTime;
+        sendUartStatus(uartCommand, status);
     }
 }
 
-void startup()
+
+// SDCC 4.2 renamed the hook called from the reset vector.
+#if __SDCC_VERSION_MAJOR > 4 || (__SDCC_VERSION_MAJOR == 4 && __SDCC_VERSION_MINOR >= 2)
+#define EXTERNAL_STARTUP __sdcc_external_startup
+#else
+#define EXTERNAL_STARTUP _sdcc_external_startup
+#endif
+
+// Runs from the reset vector, before the startup code clears the RAM and copies the initial values
+// of the variables, so it must not use any. Latches the power and sets the clock first, everything
+// after runs at FREQ_SYS instead of the 6 MHz reset clock. CfgFsys() only changes the divider of the
+// running PLL, there is nothing to wait for.
+unsigned char EXTERNAL_STARTUP()
 {
-    // Set MCU Frequency
     CfgFsys();
-    mDelaymS(5);
 
     // Configure P3.0 and P3.3 in push-pull output mode.
     // - Pn_MOD_OC = 0 (Push-Pull)
@@ -404,26 +1005,23 @@ void startup()
     P3_DIR_PU |= (1 << SHUTDOWN_PIN) | (1 << LED_PIN);
     // Power on latch, P3.3 connected to power button circuit.
     SHUTDOWN = 0;
+    // The WS2812 data line stays low until the first frame, its reset time.
+    LED = 0;
 
-    // Configure P1.1, P1.4, P1.5, P1.6, and P1.7 in Quasi-Bidirectional mode, support input with internal pull-up.
-    // - Pn_MOD_OC = 1 (Open-Drain)
-    // - Pn_DIR_PU = 1 (Pull-Up)
-    P1_MOD_OC |= (1 << KEY_A_PIN) | (1 << KEY_B_PIN) | (1 << KEY_C_PIN) | (1 << KEY_D_PIN) | (1 << KEY_E_PIN);
-    P1_DIR_PU |= (1 << KEY_A_PIN) | (1 << KEY_B_PIN) | (1 << KEY_C_PIN) | (1 << KEY_D_PIN) | (1 << KEY_E_PIN);
+    return 0;  // Go on with the variable initialisation
+}
+
+void startup()
+{
+    initClock();
+    initKeys();
+    initUart();
 
     // Turn off LDO
     GLOBAL_CFG |= bLDO3V3_OFF;
 
     // Enable ADC for battery monitor
-    // Simplified code from CH554 ADC example.
-    // 1. Enable ADC
-    ADC_CFG |= bADC_CLK;  // ADC_CLK (bit 0): 0 -> slow mode, 384 Fosc cycles for each ADC
-                          //                  1 -> fast mode,  96 Fosc cycles for each ADC
-    ADC_CFG |= bADC_EN;   // ADC_EN  (bit 3): Power enable bit of ADC module
-    // 2. Enable ADC channel 3, P3.2
-    ADC_CHAN0 = 1;
-    ADC_CHAN1 = 1;
-    P3_DIR_PU &= ~bAIN3;
+    initBattery();
 
     // Use timer0 to record system time in milliseconds
     // 1. Enable interrupt globally
@@ -434,35 +1032,34 @@ void startup()
     //   - The reset value of TMOD = 0x00
     //   - Set bT0_M1 = 0 and bT0_M0 = 1
     TMOD |= bT0_M0;
-    // 4. Start timer0
+    // 4. Overflow after the first TIMER0_STEPS x 256 counts, see timer0_interrupt()
+    TH0 = 0x100 - TIMER0_STEPS;
+    TL0 = 0;
+    // 5. Start timer0
     TR0 = 1;
 
-    // Play startup sound
+    restoreState();
+
+    // Play startup sound in background
     initBuzzer();
-    playBuzzer(startupSound);
+    startMelody(startupSound);
 }
 
+// Runs every BATTERY_INTERVAL ms, takes the reading started by the previous run and starts the next.
+// The LEDs pull the battery down while they are bright, so only a low voltage lasting
+// BATTERY_LOW_TIME powers off.
 void batteryCheck()
 {
-    static uint32_t lastCheckTime   = 0;
-    static uint8_t  batteryLowCount = 0;
+    static uint8_t batteryLowCount = 0;
 
-    // Check battery voltage every 10 seconds
-    if (systemTime - lastCheckTime >= 10000)
+    if (updateBattery())
     {
-        ADC_START = 1;     // Start ADC sampling.
-        while (ADC_START)  // Sampling completes when ADC_START becomes 0.
-        {
-        }
-
-        // Shutdown if the battery voltage detected under 3.0V for 3 times.
-        // The ADC pin is connect using a 2x100k voltage divider, thus monitoring 1.5V.
-        // Assume the voltage supply is 3.3V: 255 x 1.5V / 3.3V = 115.9
-        if (ADC_DATA < 116)  // Low voltage detected
+        if (batteryMillivolts() < BATTERY_EMPTY_MV)
         {
-            if (++batteryLowCount >= 3)
+            if (++batteryLowCount >= BATTERY_LOW_TIME / BATTERY_INTERVAL)
             {
-                playBuzzer(warningSound);
+                stopMelody();
+                startMelody(warningSound);
                 shutdown();
             }
         }
@@ -470,45 +1067,83 @@ void batteryCheck()
         {
             batteryLowCount = 0;
         }
+    }
 
-        lastCheckTime = systemTime;
+    startBatteryReading();
+}
+
+
+void idleCheck()
+{
+    if (++idleSeconds >= IDLE_TIMEOUT)
+    {
+        shutdown();
+    }
+    else if (idleSeconds == SAVE_QUIET_TIME)
+    {
+        saveState();
     }
 }
 
 void main()
 {
     startup();
-    initSubway();
+    setMenu(menuIndex);  // Restored by startup()
+
+    scheduleTask(TASK_FADE, stepFades, 0, FADE_INTERVAL);
+    scheduleTask(TASK_BATTERY, batteryCheck, 0, BATTERY_INTERVAL);
+    scheduleTask(TASK_IDLE, idleCheck, 1000, 1000);
 
     while (1)
     {
-        // Power off after idle for 5 minutes.
-        if (systemTime - lastUserActionTime >= 300000)
-        {
-            shutdown();
-        }
-
-        batteryCheck();
+        PROFILE_START(loopStart);
+        const uint16_t now = getTime();  // One snapshot per loop
 
+        runTasks(now);
         processEvents();
+        processCommands(now);
 
-        switch (menuIndex)
-        {
-            case 0:
-                blinkSubwayLights();
-                break;
-            case 1:
-                blinkLights();
-                break;
-        }
+        // WS2812 latches a frame after the data line is low for 280µs, a frame sent sooner continues
+        // the previous one and lands on the wrong LEDs. Waiting for 2 ticks guarantees at least 1ms.
+        // lastFrameTime starts as if a frame went out in the tick before reset, so the first frame
+        // leaves at tick 1, 1ms after timer0 starts with the line low since EXTERNAL_STARTUP().
+        // The WS2812 timing needs the fast clock, a frame due at the slow one waits for the next tick.
+        // An animation takes the strip over from the layers, they are drawn again once it stops.
+        __bit frameDue = animation ? animationDue : ledDirtyCount != 0;
 
-        if (ledDataChanged)
+        if (frameDue && (uint8_t)((uint8_t)now - lastFrameTime) >= 2 && !clockSlow)
         {
+            if (!animation)
+            {
+                renderFrame();
+            }
+
             EA = 0;  // Disable interrupt globally, to avoid interrupting WS2812 data transmission.
-            bigBangWS2812(LED_COUNT, ledData);
+            PROFILE_START(frameStart);
+            if (animation)
+            {
+                sendAnimationFrame();
+            }
+            else
+            {
+                bigBangWS2812(ledDirtyCount, ledData);
+                ledDirtyCount = 0;
+            }
+            takeUartPending();
+            PROFILE_FRAME(frameStart, now);
             EA = 1;  // Re-enable interrupt globally
 
-            ledDataChanged = 0;
+            lastFrameTime = now;
+            frameCount++;
+            PROFILE_LOOP(loopStart);
+        }
+        else
+        {
+            PROFILE_LOOP(loopStart);
+            // Wait for the next tick at the slow clock unless it has a frame to send, a melody is
+            // playing or the UART is in use. The remote menu keeps the fast clock for its host.
+            setSlowClock(!frameDue && !isBuzzerBusy() && isUartIdle(now) && menuIndex != MENU_REMOTE);
+            waitForTick(now);
         }
     }
 }
@@ -0,0 +1,237 @@
+#include "led.h"
+#include "bitbang.h"
+
+#ifdef LED_INDEXED
+
+// Indexed layers, the same API as led.c in 4 bits per LED, 2 LEDs a byte, the even LED in the
+// low nibble. A nibble is an entry of the palette, 0 is transparent in overlay and effects, and off
+// in background. renderFrame() composes them into frameBuffer, bigBangWS2812() expands every LED
+// through ledWire while sending.
+//
+// XRAM: 4 layers of LED_COUNT / 2 + 96 palette, 152 bytes for 27 LEDs, 696 for 300.
+#define NIBBLES(count) (((count) + 1) / 2)
+
+__xdata uint8_t background[NIBBLES(LED_COUNT)];
+__xdata uint8_t overlay[NIBBLES(LED_COUNT)];
+__xdata uint8_t effects[NIBBLES(LED_COUNT)];
+__bit           effectsShown = 0;
+
+// A single frame buffer, it is only written by renderFrame() and only sent after it.
+__xdata uint8_t          frameBuffer[NIBBLES(LED_COUNT)];
+__xdata uint8_t *__data  ledData       = frameBuffer;
+__data LedIndex          ledDirtyCount = 0;  // Render and send LED 0 to ledDirtyCount - 1 next frame
+
+// Colours in use, GRB at full range. Entry 0 stays off, entries are handed out from 1 in the
+// order colours are first drawn, and taken back once no layer uses them.
+__xdata uint8_t ledPalette[PALETTE_SIZE * 3];
+__xdata uint8_t ledWire[PALETTE_SIZE * 3];
+__data uint8_t  paletteCount = 1;
+
+__data LedIndex putIndex;  // LED putRGB() sets next, see seekRGB()
+
+// WS2812 LEDs keep their colour when the frame ends before reaching them,
+// so only the LEDs up to the last changed one are sent.
+static void markDirty(LedIndex index)
+{
+    if (index >= ledDirtyCount)
+    {
+        ledDirtyCount = index + 1;
+    }
+}
+
+static uint8_t getNibble(__xdata const uint8_t *layer, LedIndex index)
+{
+    const uint8_t pair = layer[index >> 1];
+
+    return index & 1 ? pair >> 4 : pair & 0x0F;
+}
+
+static void setNibble(__xdata uint8_t *layer, LedIndex index, uint8_t entry)
+{
+    __xdata uint8_t *const pair = &layer[index >> 1];
+
+    if (getNibble(layer, index) == entry)
+    {
+        return;
+    }
+
+    *pair = index & 1 ? (*pair & 0x0F) | (entry << 4) : (*pair & 0xF0) | entry;
+    markDirty(index);
+}
+
+// Bit n set if a layer shows palette entry n.
+static uint16_t usedEntries()
+{
+    uint16_t used = 0;
+
+    for (LedIndex i = 0; i < NIBBLES(LED_COUNT); i++)
+    {
+        const uint8_t pairs[3] = {background[i], overlay[i], effects[i]};
+
+        for (uint8_t layer = 0; layer < 3; layer++)
+        {
+            used |= 1 << (pairs[layer] & 0x0F);
+            used |= 1 << (pairs[layer] >> 4);
+        }
+    }
+    return used;
+}
+
+// Palette entry of g, r, b: the same colour, a new entry, a recycled one, or, with every entry in
+// use, the nearest colour.
+static uint8_t findEntry(uint8_t g, uint8_t r, uint8_t b)
+{
+    __xdata uint8_t *entry = &ledPalette[3];
+    uint8_t          index;
+    uint8_t          nearest  = 1;
+    uint16_t         distance = 0xFFFF;
+
+    for (index = 1; index < paletteCount; index++, entry += 3)
+    {
+        const uint16_t d = (uint16_t)(g > entry[0] ? g - entry[0] : entry[0] - g) +
+                           (r > entry[1] ? r - entry[1] : entry[1] - r) +
+                           (b > entry[2] ? b - entry[2] : entry[2] - b);
+        if (d == 0)
+        {
+            return index;
+        }
+        if (d < distance)
+        {
+            distance = d;
+            nearest  = index;
+        }
+    }
+
+    if (paletteCount < PALETTE_SIZE)
+    {
+        index = paletteCount++;
+    }
+    else
+    {
+        const uint16_t used = usedEntries();
+
+        for (index = 1; index < PALETTE_SIZE && (used & (1 << index)); index++)
+        {
+        }
+        if (index == PALETTE_SIZE)
+        {
+            return nearest;
+        }
+    }
+
+    entry    = &ledPalette[index * 3];
+    entry[0] = g;
+    entry[1] = r;
+    entry[2] = b;
+    return index;
+}
+
+void setRGB(LedIndex index, uint8_t r, uint8_t g, uint8_t b)
+{
+    setNibble(background, index, findEntry(g, r, b));
+}
+
+void setColor(LedIndex index, __code const uint8_t *color)
+{
+    setRGB(index, color[0], color[1], color[2]);
+}
+
+void seekRGB(LedIndex index)
+{
+    putIndex = index;
+}
+
+void putRGB(uint8_t r, uint8_t g, uint8_t b)
+{
+    setRGB(putIndex++, r, g, b);
+}
+
+// The palette has no room for the steps between 2 colours, a fade changes the colour at once.
+void fadeRGB(LedIndex index, uint8_t r, uint8_t g, uint8_t b, uint8_t shift)
+{
+    (void)shift;
+    setRGB(index, r, g, b);
+}
+
+void fadeColor(LedIndex index, __code const uint8_t *color, uint8_t shift)
+{
+    fadeRGB(index, color[0], color[1], color[2], shift);
+}
+
+void stepFades()
+{
+}
+
+// Show `color` over the background, 0 shows the background again.
+void setOverlay(LedIndex index, __code const uint8_t *color)
+{
+    setNibble(overlay, index, color ? findEntry(color[1], color[0], color[2]) : 0);
+}
+
+void clearOverlay()
+{
+    for (LedIndex i = 0; i < LED_COUNT; i++)
+    {
+        setOverlay(i, 0);
+    }
+}
+
+// Show r, g, b over the other layers until clearEffects().
+void setEffectRGB(LedIndex index, uint8_t r, uint8_t g, uint8_t b)
+{
+    setNibble(effects, index, findEntry(g, r, b));
+    effectsShown = 1;
+}
+
+void clearEffects()
+{
+    if (!effectsShown)
+    {
+        return;
+    }
+
+    for (LedIndex i = 0; i < sizeof(effects); i++)
+    {
+        effects[i] = 0;
+    }
+    effectsShown  = 0;
+    ledDirtyCount = LED_COUNT;
+}
+
+// The nibbles of `top`, or of `below` where `top` is transparent.
+static uint8_t over(uint8_t top, uint8_t below)
+{
+    if (!(top & 0x0F))
+    {
+        top |= below & 0x0F;
+    }
+    if (!(top & 0xF0))
+    {
+        top |= below & 0xF0;
+    }
+    return top;
+}
+
+// Compose LED 0 to ledDirtyCount - 1 into frameBuffer, and the palette at the current brightness
+// into ledWire. Only needed when ledDirtyCount is not 0, a layer has changed.
+void renderFrame()
+{
+    for (LedIndex i = 0; i < NIBBLES(ledDirtyCount); i++)
+    {
+        frameBuffer[i] = over(effects[i], over(overlay[i], background[i]));
+    }
+
+    for (uint8_t i = 0; i < sizeof(ledWire); i++)
+    {
+        ledWire[i] = GAMMA_TABLE[(ledPalette[i] & 0xFC) | ledBrightness];
+    }
+}
+
+// Send every LED again at the next brightness level.
+void cycleBrightness()
+{
+    ledBrightness = (ledBrightness + 1) & (BRIGHTNESS_LEVELS - 1);
+    ledDirtyCount = LED_COUNT;
+}
+
+#endif
@@ -0,0 +1,200 @@
+#include "profile.h"
+
+#ifdef PROFILE
+
+#include "clock.h"
+#include "uart.h"
+
+__xdata uint16_t loopCount;
+__xdata uint32_t loopTotal;
+__xdata uint16_t loopMax;
+__xdata uint16_t loopHistogram[PROFILE_BUCKETS];
+
+__xdata uint16_t frames;
+__xdata uint32_t frameTotal;  // Interrupt-off time of all frames
+__xdata uint16_t frameMax;
+
+__xdata uint16_t keyTime;  // systemTime of the first key event not shown by a frame yet
+__bit            keyWaiting = 0;
+__xdata uint16_t keyMax;
+__xdata uint16_t keyLast;
+
+__xdata uint8_t  taskScale;
+__xdata uint16_t taskTotal[TASK_COUNT];  // 16µs << taskScale
+__xdata uint16_t taskMax[TASK_COUNT];
+
+// µs since reset, wrapping at 65536.
+uint16_t profileClock()
+{
+    const __bit ea = EA;
+    EA             = 0;
+
+    uint16_t us   = systemTime * 1000 + systemTimeUs;
+    uint8_t  high = TH0;
+    uint8_t  low  = TL0;
+    if (TH0 != high)  // TL0 carried between the reads
+    {
+        high = TH0;
+        low  = TL0;
+    }
+
+    // Timer0 counts from `length` steps of TH0 before the overflow, then on from 0 with overflows
+    // timer0_interrupt() hasn't served. A step is a multiple of 4µs, low x step / 256 fits in 16
+    // bits as below.
+    const uint8_t  length = clockSlow ? TIMER0_STEPS_SLOW : TIMER0_STEPS;
+    const uint16_t step   = TIMER0_PERIOD_US / length;
+    us += (uint8_t)(high + length) * step + low * (step / 4) / 64;
+
+    EA = ea;
+    return us;
+}
+
+void profileLoop(uint16_t time)
+{
+    // Halve the counts before they overflow, the mean and the histogram's shape stay.
+    if (loopCount == 0xFFFF)
+    {
+        loopCount >>= 1;
+        loopTotal >>= 1;
+        for (uint8_t i = 0; i < PROFILE_BUCKETS; i++)
+        {
+            loopHistogram[i] >>= 1;
+        }
+    }
+
+    loopCount++;
+    loopTotal += time;
+    if (time > loopMax)
+    {
+        loopMax = time;
+    }
+
+    uint8_t bucket = 0;
+    for (uint16_t t = time >> 6; t && bucket < PROFILE_BUCKETS - 1; t >>= 1)
+    {
+        bucket++;
+    }
+    loopHistogram[bucket]++;
+}
+
+void profileFrame(uint16_t time, uint16_t now)
+{
+    if (frames == 0xFFFF)
+    {
+        frames >>= 1;
+        frameTotal >>= 1;
+    }
+
+    frames++;
+    frameTotal += time;
+    if (time > frameMax)
+    {
+        frameMax = time;
+    }
+
+    // The frame may not show the key's effect, the latency is to the first frame after it.
+    if (keyWaiting)
+    {
+        keyWaiting = 0;
+        keyLast    = now - keyTime;
+        if (keyLast > keyMax)
+        {
+            keyMax = keyLast;
+        }
+    }
+}
+
+void profileTask(uint8_t task, uint16_t time)
+{
+    const uint16_t units = (((time >> 3) + 1) >> 1) >> taskScale;  // 16µs, rounded
+
+    if (taskTotal[task] > 0xFFFF - units)
+    {
+        taskScale++;
+        for (uint8_t i = 0; i < TASK_COUNT; i++)
+        {
+            taskTotal[i] >>= 1;
+        }
+        taskTotal[task] += units >> 1;
+    }
+    else
+    {
+        taskTotal[task] += units;
+    }
+    if (time > taskMax[task])
+    {
+        taskMax[task] = time;
+    }
+}
+
+void profileKey(uint16_t time)
+{
+    if (!keyWaiting)
+    {
+        keyWaiting = 1;
+        keyTime    = time;
+    }
+}
+
+static __xdata uint8_t *putWord(__xdata uint8_t *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    return p + 2;
+}
+
+static __xdata uint8_t *putLong(__xdata uint8_t *p, uint32_t value)
+{
+    p = putWord(p, value);
+    return putWord(p, value >> 16);
+}
+
+void sendProfile(uint8_t command)
+{
+    __xdata uint8_t *p = uartPayload;
+
+    p = putWord(p, loopCount);
+    p = putWord(p, loopCount ? loopTotal / loopCount : 0);
+    p = putWord(p, loopMax);
+    for (uint8_t i = 0; i < PROFILE_BUCKETS; i++)
+    {
+        p = putWord(p, loopHistogram[i]);
+    }
+
+    p = putWord(p, frames);
+    p = putLong(p, frameTotal);
+    p = putWord(p, frameMax);
+    p = putWord(p, keyMax);
+    p = putWord(p, keyLast);
+
+    *p++ = taskScale;
+    for (uint8_t i = 0; i < TASK_COUNT; i++)
+    {
+        p = putWord(p, taskTotal[i]);
+        p = putWord(p, taskMax[i]);
+    }
+
+    sendUartPacket(command, PROFILE_LENGTH, uartPayload);
+
+    // Start the next window, a key still waiting for its frame is kept.
+    loopCount = 0;
+    loopTotal = 0;
+    loopMax   = 0;
+    for (uint8_t i = 0; i < PROFILE_BUCKETS; i++)
+    {
+        loopHistogram[i] = 0;
+    }
+    frames     = 0;
+    frameTotal = 0;
+    frameMax   = 0;
+    keyMax     = 0;
+    keyLast    = 0;
+    taskScale  = 0;
+    for (uint8_t i = 0; i < TASK_COUNT; i++)
+    {
+        taskTotal[i] = 0;
+        taskMax[i]   = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <ch554.h>
+#include <stdint.h>
+
+#include "scheduler.h"
+
+// Profiling counters, built in with `make EXTRA_FLAGS=-DPROFILE`. Without PROFILE the macros below
+// are empty and profile.c compiles to nothing.
+//
+// Times are µs from profileClock(), systemTime and the timer0 count. They wrap every 65536µs, so
+// only spans under 65ms are measured right. At the slow clock (clock.h) timer0 counts
+// CLOCK_SLOW_DIVIDER times slower, a count is worth that many more µs.
+//
+// sendProfile() sends the counters and clears them, so each packet covers the time since the
+// previous one:
+//   [loops] [loop mean] [loop max] [loop histogram x PROFILE_BUCKETS]
+//   [frames] [interrupt-off total (32-bit)] [interrupt-off max]
+//   [key to frame max (ms)] [key to frame last (ms)]
+//   [task scale (8-bit)] [task total] [task max] x TASK_COUNT
+// All 16-bit unless noted, LSB first. A task total counts 16µs << task scale: all of them are
+// halved and the scale goes up when one would overflow, like the loop and frame counts.
+
+#define PROFILE_BUCKETS 8  // Loop times under 64, 64-127, 128-255, ... 2048-4095, 4096 and over
+#define PROFILE_LENGTH  (19 + 2 * PROFILE_BUCKETS + 4 * TASK_COUNT)
+
+#ifdef PROFILE
+
+// Declare `name` and set it to the current clock
+#define PROFILE_START(name)       const uint16_t name = profileClock()
+// A main loop iteration that began at `start` ended
+#define PROFILE_LOOP(start)       profileLoop(profileClock() - (start))
+// A frame went out with interrupts off since `start`, at systemTime `now`
+#define PROFILE_FRAME(start, now) profileFrame(profileClock() - (start), now)
+// Task `task` ran since `start`
+#define PROFILE_TASK(task, start) profileTask(task, profileClock() - (start))
+// A key event scanned at systemTime `time` was handled
+#define PROFILE_KEY(time)         profileKey(time)
+
+uint16_t profileClock();
+void     profileLoop(uint16_t time);
+void     profileFrame(uint16_t time, uint16_t now);
+void     profileTask(uint8_t task, uint16_t time);
+void     profileKey(uint16_t time);
+void     sendProfile(uint8_t command);
+
+#else
+
+#define PROFILE_START(name)
+#define PROFILE_LOOP(start)
+#define PROFILE_FRAME(start, now)
+#define PROFILE_TASK(task, start)
+#define PROFILE_KEY(time)
+
+#endif
@@ -0,0 +1,93 @@
+#include "scheduler.h"
+#include "profile.h"
+
+__xdata TaskFunction taskRun[TASK_COUNT];
+__xdata uint16_t     taskDue[TASK_COUNT];
+__xdata uint16_t     taskPeriod[TASK_COUNT];
+__data uint8_t       activeTasks = 0;  // Bit n set if task n is scheduled
+__data uint16_t      taskTime    = 0;  // Time of the last runTasks(), tasks are scheduled from it
+__data uint16_t      nextDue     = 0;  // The earliest due time of all active tasks
+
+static void updateNextDue()
+{
+    // Nothing active, check again in half the tick range.
+    nextDue = taskTime + 0x7FFF;
+
+    uint8_t bit = 1;
+    for (uint8_t i = 0; i < TASK_COUNT; i++, bit <<= 1)
+    {
+        if ((activeTasks & bit) && (int16_t)(taskDue[i] - nextDue) < 0)
+        {
+            nextDue = taskDue[i];
+        }
+    }
+}
+
+void scheduleTask(uint8_t task, TaskFunction run, uint16_t delay, uint16_t period)
+{
+    const uint16_t due = taskTime + delay;
+
+    taskRun[task]    = run;
+    taskDue[task]    = due;
+    taskPeriod[task] = period;
+    activeTasks |= 1 << task;
+
+    if ((int16_t)(due - nextDue) < 0)
+    {
+        nextDue = due;
+    }
+}
+
+void cancelTask(uint8_t task)
+{
+    activeTasks &= ~(1 << task);
+}
+
+void runTasks(uint16_t now)
+{
+    taskTime = now;
+
+    if ((int16_t)(now - nextDue) < 0)
+    {
+        return;
+    }
+
+    // Collect the due tasks first, a task may schedule or cancel others.
+    uint8_t dueList = 0;
+    uint8_t bit     = 1;
+    for (uint8_t i = 0; i < TASK_COUNT; i++, bit <<= 1)
+    {
+        if ((activeTasks & bit) && (int16_t)(now - taskDue[i]) >= 0)
+        {
+            dueList |= bit;
+        }
+    }
+
+    bit = 1;
+    for (uint8_t i = 0; i < TASK_COUNT; i++, bit <<= 1)
+    {
+        // Skip a task cancelled by an earlier one.
+        if (dueList & activeTasks & bit)
+        {
+            if (taskPeriod[i])
+            {
+                taskDue[i] += taskPeriod[i];
+                if ((int16_t)(now - taskDue[i]) >= 0)
+                {
+                    // Late by more than a period, don't try to catch up.
+                    taskDue[i] = now + taskPeriod[i];
+                }
+            }
+            else
+            {
+                activeTasks &= ~bit;
+            }
+
+            PROFILE_START(start);
+            taskRun[i]();
+            PROFILE_TASK(i, start);
+        }
+    }
+
+    updateNextDue();
+}
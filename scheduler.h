@@ -0,0 +1,38 @@
+#pragma once
+
+#include <ch554.h>
+#include <stdint.h>
+
+// Cooperative scheduler on a 16-bit millisecond tick.
+// - Times are compared by their difference, a task can be scheduled up to 32767 ms ahead.
+// - Tasks due in the same tick run in the order of their numbers.
+
+#define TASK_BLINK     0  // blinkSubwayLights() or blinkLights()
+#define TASK_BATTERY   1  // batteryCheck()
+#define TASK_IDLE      2  // Power off when idle
+#define TASK_FADE      3  // stepFades()
+#define TASK_TIMETABLE 4  // runTimetable()
+#define TASK_ANIMATION 5  // Steps of the animation playing, see animation.h
+#define TASK_COUNT     6
+
+// Timer0 counts at MCU_Frequency/12 and overflows every TIMER0_STEPS steps of TH0, 256 counts each,
+// about every ms, see timer0_interrupt().
+#define TIMER0_STEPS     ((FREQ_SYS + 1536000) / 3072000)
+#define TIMER0_PERIOD_US (TIMER0_STEPS * 256 * 12 * 1000L / (FREQ_SYS / 1000))
+
+#if TIMER0_STEPS * 256 * 12 * 1000L % (FREQ_SYS / 1000)
+#error "The timer0 period must be a whole number of µs at this FREQ_SYS"
+#endif
+
+// Milliseconds since reset, kept by timer0_interrupt(), read it with getTime().
+extern __data volatile uint16_t systemTime;
+extern __data uint16_t          systemTimeUs;  // µs past systemTime
+
+typedef void (*TaskFunction)();
+
+// Run `run` after `delay` ms, then every `period` ms. A period of 0 runs it once.
+void scheduleTask(uint8_t task, TaskFunction run, uint16_t delay, uint16_t period);
+void cancelTask(uint8_t task);
+
+// Run the tasks due at `now`, returns quickly when none is.
+void runTasks(uint16_t now);
@@ -0,0 +1,89 @@
+#include "state.h"
+#include "dataflash.h"
+
+#define SLOT_SIZE   (STATE_SIZE + 2)
+#define SLOT_COUNT  (DATA_FLASH_SIZE / SLOT_SIZE)
+#define CHECK_SEED  0xA5  // Keeps erased slots, all 0x00 or all 0xFF, from passing the check
+#define NO_SLOT     0xFF
+
+__xdata uint8_t stateSlot[SLOT_SIZE];
+__data uint8_t  latestSlot     = NO_SLOT;
+__data uint8_t  latestSequence = 0;
+
+static uint8_t slotCheck()
+{
+    uint8_t sum = CHECK_SEED;
+    for (uint8_t i = 0; i < SLOT_SIZE - 1; i++)
+    {
+        sum += stateSlot[i];
+    }
+    return sum;
+}
+
+static void readSlot(uint8_t slot)
+{
+    for (uint8_t i = 0; i < SLOT_SIZE; i++)
+    {
+        stateSlot[i] = readDataFlash(slot * SLOT_SIZE + i);
+    }
+}
+
+__bit readState(__xdata uint8_t *state)
+{
+    latestSlot = NO_SLOT;
+
+    for (uint8_t slot = 0; slot < SLOT_COUNT; slot++)
+    {
+        readSlot(slot);
+
+        // Sequences in the log are consecutive, so their 8-bit difference orders them.
+        if (stateSlot[SLOT_SIZE - 1] == slotCheck() &&
+            (latestSlot == NO_SLOT || (int8_t)(stateSlot[0] - latestSequence) > 0))
+        {
+            latestSlot     = slot;
+            latestSequence = stateSlot[0];
+        }
+    }
+
+    if (latestSlot == NO_SLOT)
+    {
+        return 0;
+    }
+
+    // Keep the latest slot in stateSlot, writeState() compares against it.
+    readSlot(latestSlot);
+    for (uint8_t i = 0; i < STATE_SIZE; i++)
+    {
+        state[i] = stateSlot[1 + i];
+    }
+    return 1;
+}
+
+void writeState(__xdata const uint8_t *state)
+{
+    __bit changed = latestSlot == NO_SLOT;
+
+    for (uint8_t i = 0; i < STATE_SIZE; i++)
+    {
+        if (stateSlot[1 + i] != state[i])
+        {
+            changed = 1;
+        }
+    }
+    if (!changed)
+    {
+        return;
+    }
+
+    latestSlot = latestSlot == NO_SLOT || latestSlot == SLOT_COUNT - 1 ? 0 : latestSlot + 1;
+    latestSequence++;
+
+    stateSlot[0] = latestSequence;
+    for (uint8_t i = 0; i < STATE_SIZE; i++)
+    {
+        stateSlot[1 + i] = state[i];
+    }
+    stateSlot[SLOT_SIZE - 1] = slotCheck();
+
+    writeDataFlash(latestSlot * SLOT_SIZE, stateSlot, SLOT_SIZE);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <ch554.h>
+#include <stdint.h>
+
+// State kept over power-offs, STATE_SIZE bytes packed by main.c, logged in the DataFlash.
+// - Each save writes the next of 16 slots, so a DataFlash byte is written once every 16 saves.
+// - A slot is [sequence] [state x STATE_SIZE] [check], the valid slot with the latest sequence is
+//   read back. A save cut off by a power loss fails its check, the one before it is read instead.
+// - A save equal to the latest slot writes nothing.
+//
+// Write budget, 10,000 writes per byte x 16 slots = 160,000 saves. main.c saves on power-off and
+// after SAVE_QUIET_TIME without keys or commands:
+//   Use                                                        Saves/day   Lifetime
+//   Heavy, 3 hours of play with a pause every 5 min, 10 power-offs    46   9.5 years
+//   Worst, a change every 61s for 8 hours                            472   0.9 years
+#define STATE_SIZE 6
+
+// Read the latest state saved, returns 0 if there is none. Call it once before writeState().
+__bit readState(__xdata uint8_t *state);
+void  writeState(__xdata const uint8_t *state);
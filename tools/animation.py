@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""Convert frames of LED colours into `__code` animations for startAnimation(), see animation.h.
+
+Input is CSV, one frame per line: the steps it is shown for, then an RRGGBB colour per LED.
+Lines starting with `#` are comments.
+
+    5, ff0000, ff0000, 000000, 0000ff
+    5, 000000, ff0000, ff0000, 000000
+
+or a PNG image strip, one frame per row of pixels and one LED per column, every row shown for
+1 step. The step is --interval ms.
+
+    tools/animation.py show.csv --interval 40 > show.inc
+    tools/animation.py strip.png --name rainbow --leds 27
+
+The first frame is a keyframe, the others only cover the LEDs up to the last one that changed,
+and a frame without a change extends the one before it.
+"""
+
+import argparse
+import csv
+import os
+import struct
+import sys
+import zlib
+
+FRAME_END = "ANIM_FRAME_END"
+END = "ANIM_END"
+RUN_MAX = 127
+STEPS_MAX = 255
+
+
+def identifier(path):
+    stem = os.path.splitext(os.path.basename(path))[0]
+    if stem.isidentifier():
+        return stem
+    words = "".join(c if c.isalnum() else " " for c in stem).split()
+    if not words:
+        return "animation"
+    text = words[0].lower() + "".join(w.capitalize() for w in words[1:])
+    return "_" + text if text[0].isdigit() else text
+
+
+def read_csv(path):
+    frames = []
+    with open(path, newline="") as source:
+        for number, row in enumerate(csv.reader(source), 1):
+            cells = [cell.strip() for cell in row]
+            if not cells or not cells[0] or cells[0].startswith("#"):
+                continue
+            try:
+                steps = int(cells[0])
+                colors = [tuple(bytes.fromhex(cell.lstrip("#"))) for cell in cells[1:] if cell]
+            except ValueError:
+                sys.exit(f"line {number}: bad steps or colour")
+            if not 1 <= steps <= STEPS_MAX or any(len(color) != 3 for color in colors):
+                sys.exit(f"line {number}: steps are 1 - {STEPS_MAX}, colours RRGGBB")
+            frames.append((steps, colors))
+    return frames
+
+
+def read_png(path):
+    with open(path, "rb") as source:
+        data = source.read()
+    if data[:8] != b"\x89PNG\r\n\x1a\n":
+        sys.exit(f"{path}: not a PNG")
+
+    chunks = {}
+    offset = 8
+    while offset < len(data):
+        length, kind = struct.unpack(">I4s", data[offset : offset + 8])
+        chunks.setdefault(kind, b"")
+        chunks[kind] += data[offset + 8 : offset + 8 + length]
+        offset += 12 + length
+
+    width, height, depth, color_type, _, _, interlace = struct.unpack(">IIBBBBB", chunks[b"IHDR"])
+    channels = {2: 3, 6: 4}.get(color_type)
+    if depth != 8 or not channels or interlace:
+        sys.exit(f"{path}: only 8-bit RGB or RGBA PNGs without interlacing")
+
+    raw = zlib.decompress(chunks[b"IDAT"])
+    stride = width * channels
+    previous = bytearray(stride)
+    frames = []
+    for y in range(height):
+        line = raw[y * (stride + 1) : (y + 1) * (stride + 1)]
+        kind, row = line[0], bytearray(line[1:])
+        for x in range(stride):
+            left = row[x - channels] if x >= channels else 0
+            up = previous[x]
+            corner = previous[x - channels] if x >= channels else 0
+            if kind == 1:
+                row[x] = (row[x] + left) & 0xFF
+            elif kind == 2:
+                row[x] = (row[x] + up) & 0xFF
+            elif kind == 3:
+                row[x] = (row[x] + (left + up) // 2) & 0xFF
+            elif kind == 4:
+                p = left + up - corner
+                pa, pb, pc = abs(p - left), abs(p - up), abs(p - corner)
+                row[x] = (row[x] + (left if pa <= pb and pa <= pc else up if pb <= pc else corner)) & 0xFF
+        previous = row
+        frames.append((1, [tuple(row[x : x + 3]) for x in range(0, stride, channels)]))
+    return frames
+
+
+def runs(colors):
+    """Fill runs for 2 LEDs or more of 1 colour, literal runs in between."""
+    codes = []
+    literal = []
+
+    def flush():
+        while literal:
+            chunk = literal[:RUN_MAX]
+            del literal[:RUN_MAX]
+            codes.append((f"ANIM_LITERAL({len(chunk)})", chunk))
+
+    i = 0
+    while i < len(colors):
+        n = 1
+        while i + n < len(colors) and colors[i + n] == colors[i] and n < RUN_MAX:
+            n += 1
+        if n >= 2:
+            flush()
+            codes.append((f"ANIM_FILL({n})", [colors[i]]))
+        else:
+            literal.append(colors[i])
+        i += n
+    flush()
+    return codes
+
+
+def encode(frames, keyframe):
+    shown = None
+    encoded = []
+    for index, (steps, colors) in enumerate(frames):
+        if shown is None or (keyframe and index % keyframe == 0) or len(colors) > len(shown):
+            cover = len(colors)
+        else:
+            changed = [i for i, color in enumerate(colors) if color != shown[i]]
+            cover = changed[-1] + 1 if changed else 0
+        shown = list(colors) + (shown[len(colors) :] if shown else [])
+
+        if cover == 0 and encoded and encoded[-1][0] + steps <= STEPS_MAX:
+            encoded[-1][0] += steps
+        else:
+            encoded.append([steps, runs(colors[:cover])])
+    return encoded
+
+
+def emit(out, name, source, interval, encoded):
+    rows = [[str(interval)]]
+    for steps, codes in encoded:
+        row = [str(steps)]
+        for run, colors in codes:
+            row.append(run)
+            for r, g, b in colors:
+                row += [f"0x{g:02X}", f"0x{r:02X}", f"0x{b:02X}"]
+        rows.append(row + [FRAME_END])
+    rows.append([END])
+    size = sum(len(row) for row in rows)
+
+    out.write(f"// {os.path.basename(source)}, {len(encoded)} frames of {interval}ms steps\n")
+    out.write(f"__code const uint8_t {name}[] = {{  // {size} bytes\n")
+    for row in rows:
+        line = "   "
+        for code in row:
+            if len(line) + len(code) + 2 > 100:
+                out.write(line.rstrip() + "\n")
+                line = "       "
+            line += f" {code},"
+        out.write(line + "\n")
+    out.write("};\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="CSV or PNG file")
+    parser.add_argument("--name", help="array name, default from the file name")
+    parser.add_argument("--interval", type=int, default=50, help="ms of a step, 2 - 255")
+    parser.add_argument("--leds", type=int, help="LED count of the strip, frames may not be longer")
+    parser.add_argument("--keyframe", type=int, default=0, help="a keyframe every N frames, 0 = only the first")
+    args = parser.parse_args()
+
+    if not 2 <= args.interval <= 255:
+        sys.exit("--interval must be in 2 - 255")
+
+    frames = read_png(args.input) if args.input.lower().endswith(".png") else read_csv(args.input)
+    if not frames or not frames[0][1]:
+        sys.exit(f"{args.input}: no frames")
+    if args.leds and any(len(colors) > args.leds for _, colors in frames):
+        sys.exit(f"{args.input}: a frame is longer than {args.leds} LEDs")
+
+    emit(sys.stdout, args.name or identifier(args.input), args.input, args.interval,
+         encode(frames, args.keyframe))
+
+
+if __name__ == "__main__":
+    main()
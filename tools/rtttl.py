@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""Convert RTTTL ringtones into `__code` melodies for startMelody(), see buzzer.h.
+
+Input is RTTTL, `name:d=4,o=6,b=63:8e6,8d#6,p,...`, one melody per line. The name and settings
+sections are optional, so a plain list of RTTTL notes also works. Lines starting with `#` are
+comments, and a melody may be wrapped over several lines by ending them with `,`.
+
+    tools/rtttl.py songs.txt > songs.inc
+    echo "star:d=8,o=4,b=120:c,c,g,g,a,a,4g" | tools/rtttl.py -
+
+Notes outside C3 - B7 are an error unless --transpose moves them into range.
+"""
+
+import argparse
+import re
+import sys
+
+OCTAVE_MIN = 3
+OCTAVE_MAX = 7
+
+DEFAULT_TEMPO = 120
+DEFAULT_OCTAVE = 4
+DEFAULT_GAP = 3
+
+SEMITONES = ["C", "CS", "D", "DS", "E", "F", "FS", "G", "GS", "A", "AS", "B"]
+LETTERS = {"c": 0, "d": 2, "e": 4, "f": 5, "g": 7, "a": 9, "b": 11, "h": 11}
+LENGTHS = {1: "LEN_1", 2: "LEN_2", 4: "LEN_4", 8: "LEN_8", 16: "LEN_16", 32: "LEN_32", 64: "LEN_64"}
+
+NOTE = re.compile(r"^(\d+)?([a-hp])(#?)(\.?)(\d)?(\.?)$")
+
+
+def identifier(name):
+    words = re.findall(r"[A-Za-z0-9]+", name)
+    if not words:
+        return "melody"
+    text = words[0].lower() + "".join(w.capitalize() for w in words[1:])
+    return "_" + text if text[0].isdigit() else text
+
+
+def tempo_units(bpm):
+    # Same rounding as TEMPO(bpm) in buzzer.h
+    return (3750 + bpm // 2) // bpm
+
+
+def parse(text, line, transpose):
+    parts = text.split(":")
+    if len(parts) > 3:
+        sys.exit(f"line {line}: too many ':' in {text!r}")
+    name = parts[0].strip() if len(parts) >= 2 else ""
+    settings = parts[1] if len(parts) == 3 else ""
+    notes = parts[-1]
+
+    defaults = {"d": 4, "o": 6, "b": 63}
+    for setting in filter(None, (s.strip() for s in settings.split(","))):
+        key, _, value = setting.partition("=")
+        if key.strip().lower() not in defaults or not value.strip().isdigit():
+            sys.exit(f"line {line}: bad setting {setting!r}")
+        defaults[key.strip().lower()] = int(value)
+
+    if not 15 <= defaults["b"] <= 3750:
+        sys.exit(f"line {line}: tempo {defaults['b']} is out of range")
+
+    melody = []
+    for token in filter(None, (t.strip().lower() for t in notes.split(","))):
+        match = NOTE.match(token)
+        if not match:
+            sys.exit(f"line {line}: bad note {token!r}")
+        length, letter, sharp, dot1, octave, dot2 = match.groups()
+
+        length = int(length) if length else defaults["d"]
+        if length not in LENGTHS:
+            sys.exit(f"line {line}: bad length in {token!r}")
+        dotted = bool(dot1 or dot2)
+
+        if letter == "p":
+            melody.append((None, None, length, dotted))
+            continue
+
+        pitch = (int(octave) if octave else defaults["o"]) * 12 + LETTERS[letter] + (1 if sharp else 0)
+        pitch += transpose
+        if not OCTAVE_MIN * 12 <= pitch < (OCTAVE_MAX + 1) * 12:
+            sys.exit(f"line {line}: {token!r} is out of C{OCTAVE_MIN} - B{OCTAVE_MAX}, see --transpose")
+        melody.append((pitch // 12, pitch % 12, length, dotted))
+
+    if not melody:
+        sys.exit(f"line {line}: no notes")
+    return name, defaults["b"], melody
+
+
+def emit(out, name, text, bpm, melody, gap):
+    codes = []
+    if tempo_units(bpm) != tempo_units(DEFAULT_TEMPO):
+        codes.append(f"TEMPO({bpm})")
+    if gap != DEFAULT_GAP:
+        codes.append(f"GAP({gap})")
+
+    octave = DEFAULT_OCTAVE
+    for note_octave, semitone, length, dotted in melody:
+        if note_octave is not None and note_octave != octave:
+            codes.append(f"OCTAVE({note_octave})")
+            octave = note_octave
+        note = "NOTE_REST" if semitone is None else f"NOTE_{SEMITONES[semitone]}"
+        codes.append(f"{note} | {LENGTHS[length]}" + (" | LEN_DOT" if dotted else ""))
+    codes.append("MELODY_END")
+    size = sum(2 if code.startswith("TEMPO") else 1 for code in codes)
+
+    out.write(f"// {text}\n")
+    out.write(f"__code const uint8_t {name}[] = {{  // {size} bytes\n")
+    row = "   "
+    for code in codes:
+        if len(row) + len(code) + 2 > 100:
+            out.write(row.rstrip() + "\n")
+            row = "   "
+        row += f" {code},"
+    out.write(row[:-1] + "\n};\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="RTTTL file, - for stdin")
+    parser.add_argument("--name", help="array name of the first melody, default from the RTTTL name")
+    parser.add_argument("--transpose", type=int, default=0, help="semitones added to every note")
+    parser.add_argument("--gap", type=int, default=DEFAULT_GAP, help="GAP() of the melodies, 0 - 15")
+    args = parser.parse_args()
+
+    if not 0 <= args.gap <= 15:
+        sys.exit("--gap must be in 0 - 15")
+
+    source = sys.stdin if args.input == "-" else open(args.input)
+    with source:
+        lines = [line.strip() for line in source]
+
+    melodies = []
+    text = ""
+    for number, line in enumerate(lines, 1):
+        if not line or line.startswith("#"):
+            continue
+        text += line
+        if not line.endswith(","):
+            melodies.append((number, text))
+            text = ""
+    if text:
+        melodies.append((len(lines), text.rstrip(",")))
+
+    names = set()
+    for index, (number, text) in enumerate(melodies):
+        name, bpm, melody = parse(text, number, args.transpose)
+        name = args.name if args.name and index == 0 else identifier(name) if name else f"melody{index}"
+        if name in names:
+            sys.exit(f"line {number}: {name} is defined twice")
+        names.add(name)
+
+        if index:
+            sys.stdout.write("\n")
+        emit(sys.stdout, name, text, bpm, melody, args.gap)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,271 @@
+#include "uart.h"
+#include "clock.h"
+
+#define RXD_PIN 2  // P1.2
+#define TXD_PIN 3  // P1.3
+
+// Timer1 in 8-bit auto-reload mode, clocked at MCU_Frequency (bTMR_CLK = bT1_CLK = 1), SMOD = 1.
+//   -> Baud = MCU_Frequency / 16 / (256 - TH1)
+// MCU Frequency    9600           38400          57600          115200
+//        32 MHz                                  35 (-0.79%)    17 (+2.1%)
+//        24 MHz                                  26 (+0.16%)    13 (+0.16%)
+//        16 MHz                   26 (+0.16%)    17 (+2.1%)
+//        12 MHz                                  13 (+0.16%)     7 (-7.0%)
+//         6 MHz    39 (+0.16%)    10 (-2.3%)
+// UART_BAUD of uart.h picks the fastest one within 2% for every clock, checked below.
+#define UART_DIVIDER ((FREQ_SYS / 16 + UART_BAUD / 2) / UART_BAUD)
+#define UART_ACTUAL  (FREQ_SYS / 16 / UART_DIVIDER)
+
+#if UART_DIVIDER < 1 || UART_DIVIDER > 256
+#error "UART_BAUD can't be divided from this FREQ_SYS"
+#endif
+#if UART_ACTUAL * 50 > UART_BAUD * 51 || UART_ACTUAL * 50 < UART_BAUD * 49
+#error "UART_BAUD is more than 2% off at this FREQ_SYS"
+#endif
+
+// Rings, written by uart0_interrupt() and read by the main loop, or the other way round.
+// Both sizes must be powers of 2.
+#define RX_SIZE 64
+#define TX_SIZE 32
+__xdata uint8_t         rxRing[RX_SIZE];
+__data volatile uint8_t rxHead = 0;
+__data volatile uint8_t rxTail = 0;
+__xdata uint8_t         txRing[TX_SIZE];
+__data volatile uint8_t txHead = 0;
+__data volatile uint8_t txTail = 0;
+volatile __bit          txBusy = 0;  // SBUF is sending, the next byte goes out from the interrupt
+volatile __bit          rxWake = 0;  // A byte came in at the slow clock, see isUartIdle()
+
+__idata uint8_t uartPending[UART_PENDING_SIZE];
+__data uint8_t  uartPendingCount = 0;
+
+// Parser
+#define WAIT_SYNC    0
+#define WAIT_COMMAND 1
+#define WAIT_LENGTH  2
+#define WAIT_PAYLOAD 3
+#define WAIT_CHECK   4
+__data uint8_t  parserState = WAIT_SYNC;
+__data uint8_t  parserCheck;
+__data uint8_t  parserCount;
+__data uint16_t parserTime;  // Time of the last byte
+__bit           uartAwake = 0;  // A byte came in during the last UART_AWAKE_TIME ms
+
+__data uint8_t  uartCommand;
+__data uint8_t  uartLength;
+__xdata uint8_t uartPayload[UART_MAX_PAYLOAD];
+
+__data uint8_t uartOverflows  = 0;
+__data uint8_t uartBadPackets = 0;
+
+void initUart()
+{
+    // Move UART0 to P1.2/P1.3
+    // - RXD in Quasi-Bidirectional mode, Pn_MOD_OC = 1, Pn_DIR_PU = 1
+    // - TXD in push-pull output mode, Pn_MOD_OC = 0, Pn_DIR_PU = 1
+    PIN_FUNC |= bUART0_PIN_X;
+    P1_MOD_OC = (P1_MOD_OC | (1 << RXD_PIN)) & ~(1 << TXD_PIN);
+    P1_DIR_PU |= (1 << RXD_PIN) | (1 << TXD_PIN);
+
+    // Timer1 as the baud generator, see UART_DIVIDER.
+    TMOD  = (TMOD & 0x0F) | bT1_M1;
+    T2MOD |= bTMR_CLK | bT1_CLK;  // Timer0 and timer2 keep MCU_Frequency/12, bT0_CLK = bT2_CLK = 0
+    PCON |= SMOD;
+    TH1 = 256 - UART_DIVIDER;
+    TR1 = 1;
+
+    // Mode 1 (8-bit, variable baud), receiver enabled: SM0 = 0, SM1 = 1, REN = 1
+    SCON = 0x50;
+    PS   = 1;  // High priority, a byte must be taken before the next one ends.
+    ES   = 1;
+}
+
+// Also runs in uart0_interrupt(), its parameters must not share memory with the main loop.
+#pragma save
+#pragma nooverlay
+static void pushRx(uint8_t value)
+{
+    const uint8_t next = (rxHead + 1) & (RX_SIZE - 1);
+    if (next == rxTail)
+    {
+        uartOverflows++;
+        return;
+    }
+
+    rxRing[rxHead] = value;
+    rxHead         = next;
+}
+#pragma restore
+
+void uart0_interrupt(void) __interrupt(INT_NO_UART0)
+{
+    if (RI)
+    {
+        RI = 0;
+        if (clockSlow)
+        {
+            rxWake = 1;  // Garbled at the baud rate of the slow clock
+        }
+        else
+        {
+            pushRx(SBUF);
+        }
+    }
+
+    if (TI)
+    {
+        TI = 0;
+        if (txTail != txHead)
+        {
+            SBUF   = txRing[txTail];
+            txTail = (txTail + 1) & (TX_SIZE - 1);
+        }
+        else
+        {
+            txBusy = 0;
+        }
+    }
+}
+
+// Move the bytes bigBangWS2812() took while interrupts were off into the ring.
+// Runs before EA is set again, so they stay ahead of the next byte uart0_interrupt() takes.
+void takeUartPending()
+{
+    for (uint8_t i = 0; i < uartPendingCount; i++)
+    {
+        pushRx(uartPending[i]);
+    }
+    uartPendingCount = 0;
+}
+
+static __bit isTxFull()
+{
+    return ((txHead + 1) & (TX_SIZE - 1)) == txTail;
+}
+
+static void sendByte(uint8_t value)
+{
+    // Wait for room, a packet is at most a few ms of UART time. The check is a call, so the clock
+    // of the host build advances while a packet longer than the ring waits.
+    while (isTxFull())
+    {
+    }
+
+    ES = 0;
+    if (!txBusy)
+    {
+        txBusy = 1;
+        SBUF   = value;
+    }
+    else
+    {
+        txRing[txHead] = value;
+        txHead         = (txHead + 1) & (TX_SIZE - 1);
+    }
+    ES = 1;
+}
+
+void sendUartPacket(uint8_t command, uint8_t length, __xdata const uint8_t *payload)
+{
+    uint8_t check = command + length;
+
+    sendByte(UART_SYNC_REPLY);
+    sendByte(command);
+    sendByte(length);
+    for (uint8_t i = 0; i < length; i++)
+    {
+        sendByte(payload[i]);
+        check += payload[i];
+    }
+    sendByte(check);
+}
+
+void sendUartStatus(uint8_t command, uint8_t status)
+{
+    uartPayload[0] = status;
+    sendUartPacket(command, 1, uartPayload);
+}
+
+// Parse the received bytes, returns 1 when a packet is complete in uartCommand, uartLength and
+// uartPayload. Packets with a bad length or check are answered here and dropped.
+__bit readUartPacket(uint16_t now)
+{
+    // Called every loop, the difference is checked long before `now` wraps back onto parserTime.
+    if (uartAwake && (uint16_t)(now - parserTime) >= UART_AWAKE_TIME)
+    {
+        uartAwake = 0;
+    }
+
+    if (parserState != WAIT_SYNC && (uint16_t)(now - parserTime) >= UART_TIMEOUT)
+    {
+        parserState = WAIT_SYNC;
+        uartBadPackets++;
+    }
+
+    while (rxTail != rxHead)
+    {
+        const uint8_t value = rxRing[rxTail];
+        rxTail              = (rxTail + 1) & (RX_SIZE - 1);
+        parserTime          = now;
+        uartAwake           = 1;
+
+        switch (parserState)
+        {
+            case WAIT_SYNC:
+                if (value == UART_SYNC_REQUEST)
+                {
+                    parserState = WAIT_COMMAND;
+                }
+                break;
+            case WAIT_COMMAND:
+                uartCommand = value;
+                parserCheck = value;
+                parserState = WAIT_LENGTH;
+                break;
+            case WAIT_LENGTH:
+                if (value > UART_MAX_PAYLOAD)
+                {
+                    parserState = WAIT_SYNC;
+                    uartBadPackets++;
+                    sendUartStatus(uartCommand, UART_BAD_LENGTH);
+                    break;
+                }
+                uartLength  = value;
+                parserCheck += value;
+                parserCount = 0;
+                parserState = value ? WAIT_PAYLOAD : WAIT_CHECK;
+                break;
+            case WAIT_PAYLOAD:
+                uartPayload[parserCount++] = value;
+                parserCheck += value;
+                if (parserCount == uartLength)
+                {
+                    parserState = WAIT_CHECK;
+                }
+                break;
+            case WAIT_CHECK:
+                parserState = WAIT_SYNC;
+                if (value != parserCheck)
+                {
+                    uartBadPackets++;
+                    sendUartStatus(uartCommand, UART_BAD_CHECK);
+                    break;
+                }
+                return 1;
+        }
+    }
+    return 0;
+}
+
+__bit isUartIdle(uint16_t now)
+{
+    // A byte lost at the slow clock counts as received, the next ones come in at the fast clock.
+    if (rxWake)
+    {
+        rxWake     = 0;
+        parserTime = now;
+        uartAwake  = 1;
+    }
+
+    return !txBusy && parserState == WAIT_SYNC && rxTail == rxHead && !uartAwake;
+}
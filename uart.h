@@ -0,0 +1,64 @@
+#pragma once
+
+#include <ch554.h>
+#include <stdint.h>
+
+// UART0 on P1.2 (RXD) and P1.3 (TXD), P3.0 is the LED data pin.
+// 8N1, UART_BAUD must be within 2% of what FREQ_SYS can divide to, see the table of uart.c.
+#ifndef UART_BAUD
+#if FREQ_SYS == 24000000
+#define UART_BAUD 115200
+#elif FREQ_SYS == 16000000
+#define UART_BAUD 38400  // 57600 is 2.1% off
+#elif FREQ_SYS == 6000000
+#define UART_BAUD 9600  // 19200 and 38400 are 2.3% off
+#else
+#define UART_BAUD 57600  // 32 and 12 MHz, 115200 is 2.1% and 7.0% off
+#endif
+#endif
+
+// While the toy waits at the slow clock (clock.h), a byte sent to it is lost and switches it to the
+// fast clock within 1ms. A host starts with a lone sync byte and waits 2ms, or repeats a packet
+// left without a reply.
+//
+// Packets, both ways:
+//   [sync] [command] [length] [payload x length] [check]
+//   - sync is UART_SYNC_REQUEST from the host, UART_SYNC_REPLY from the toy.
+//   - check is the 8-bit sum of command, length and payload.
+#define UART_SYNC_REQUEST 0xA5
+#define UART_SYNC_REPLY   0x5A
+#define UART_MAX_PAYLOAD  82  // A full frame: first LED + 27 x RGB
+#define UART_TIMEOUT      50  // ms, a packet stalled this long is dropped
+#define UART_AWAKE_TIME   2000  // ms the fast clock is kept after the last byte received, see clock.h
+
+// Status, the payload of a reply without data
+#define UART_OK           0
+#define UART_BAD_LENGTH   1
+#define UART_BAD_VALUE    2
+#define UART_BAD_COMMAND  3
+#define UART_BAD_CHECK    4
+
+// Bytes received while interrupts are off, see bigBangWS2812().
+#define UART_PENDING_SIZE 16
+extern __idata uint8_t uartPending[UART_PENDING_SIZE];
+extern __data uint8_t  uartPendingCount;
+
+// Received packet, valid after readUartPacket() returns 1.
+extern __data uint8_t  uartCommand;
+extern __data uint8_t  uartLength;
+extern __xdata uint8_t uartPayload[UART_MAX_PAYLOAD];
+
+// Errors since reset
+extern __data uint8_t uartOverflows;
+extern __data uint8_t uartBadPackets;
+
+void  initUart();
+void  takeUartPending();
+__bit readUartPacket(uint16_t now);
+void  sendUartPacket(uint8_t command, uint8_t length, __xdata const uint8_t *payload);
+void  sendUartStatus(uint8_t command, uint8_t status);
+// Nothing received for UART_AWAKE_TIME and nothing left to send.
+__bit isUartIdle(uint16_t now);
+
+// SDCC requires the prototype of an interrupt service routine to be visible in main.c.
+void uart0_interrupt(void) __interrupt(INT_NO_UART0);